@@ -1,6 +1,8 @@
 
 import Lustre
 import qualified Data.Map as M
+import qualified Wire as W
+import Data.Word ( Word8 )
 
 --------------------------------------------------------------------------------
 -- general, very simple, Lustre bluetooth API
@@ -33,6 +35,25 @@ isWrite :: Msg -> Bool
 isWrite (Write _) = True
 isWrite _         = False
 
+-- the wire format is generated from example/common/wire.schema
+
+toWire :: Msg -> W.Msg
+toWire Read      = W.Read
+toWire (Write s) = W.Write (map (fromIntegral . fromEnum) s)
+
+fromWire :: W.Msg -> Msg
+fromWire W.Read       = Read
+fromWire (W.Write bs) = Write (map (toEnum . fromIntegral) bs)
+
+encodeMsg :: Msg -> [Word8]
+encodeMsg = W.encodeMsg . toWire
+
+decodeMsg :: [Word8] -> Maybe Msg
+decodeMsg bs =
+  case W.decodeMsg bs of
+    Just (m, []) -> Just (fromWire m)
+    _            -> Nothing
+
 --------------------------------------------------------------------------------
 -- simple server (same as the simple Zephyr example)
 
@@ -0,0 +1,119 @@
+-- Generated by WireGen.hs from wire.schema, do not edit by hand.
+
+module Wire where
+
+import Data.Bits
+import Data.Int
+import Data.Word
+
+--------------------------------------------------------------------------------
+-- primitives
+
+putUInt :: Word32 -> [Word8]
+putUInt x
+  | x < 0x80  = [fromIntegral x]
+  | otherwise = (fromIntegral (x .&. 0x7f) .|. 0x80) : putUInt (x `shiftR` 7)
+
+putSInt :: Int32 -> [Word8]
+putSInt x = putUInt (fromIntegral ((x `shiftL` 1) `xor` (x `shiftR` 31)))
+
+putBytes :: [Word8] -> [Word8]
+putBytes bs = putUInt (fromIntegral (length bs)) ++ bs
+
+getUInt :: [Word8] -> Maybe (Word32, [Word8])
+getUInt = go 0 0
+ where
+  go :: Int -> Word32 -> [Word8] -> Maybe (Word32, [Word8])
+  go shift acc (b:bs)
+    | shift == 28 && b > 0x0f = Nothing -- the fifth byte only carries bits 28 to 31
+    | shift < 35 && b < 0x80  = Just (acc .|. (fromIntegral b `shiftL` shift), bs)
+    | shift < 35              = go (shift+7) (acc .|. (fromIntegral (b .&. 0x7f) `shiftL` shift)) bs
+  go _ _ _ = Nothing
+
+getSInt :: [Word8] -> Maybe (Int32, [Word8])
+getSInt bs =
+  do (u, bs') <- getUInt bs
+     return (fromIntegral (u `shiftR` 1) `xor` negate (fromIntegral (u .&. 1)), bs')
+
+getBytes :: [Word8] -> Maybe ([Word8], [Word8])
+getBytes bs =
+  do (n, bs') <- getUInt bs
+     let n' = fromIntegral n
+     if length (take n' bs') == n' then Just (splitAt n' bs') else Nothing
+
+--------------------------------------------------------------------------------
+-- union Sample
+
+data Sample
+  = Temperature Int32 Word32 -- value, seq
+  | Octavius Word32 Word32 -- open, seq
+ deriving ( Eq, Ord, Show )
+
+encodeSample :: Sample -> [Word8]
+encodeSample (Temperature a1 a2) = putUInt 1 ++ putSInt a1 ++ putUInt a2
+encodeSample (Octavius a1 a2) = putUInt 2 ++ putUInt a1 ++ putUInt a2
+
+decodeSample :: [Word8] -> Maybe (Sample, [Word8])
+decodeSample bs0 =
+  do (tag, bs1) <- getUInt bs0
+     case tag of
+       1 -> do { (a1, bs2) <- getSInt bs1; (a2, bs3) <- getUInt bs2; return (Temperature a1 a2, bs3) }
+       2 -> do { (a1, bs2) <- getUInt bs1; (a2, bs3) <- getUInt bs2; return (Octavius a1 a2, bs3) }
+       _ -> Nothing
+
+--------------------------------------------------------------------------------
+-- union Broadcast
+
+data Broadcast
+  = Samples Word32 Int32 Word32 -- version, temperature, octavius
+ deriving ( Eq, Ord, Show )
+
+encodeBroadcast :: Broadcast -> [Word8]
+encodeBroadcast (Samples a1 a2 a3) = putUInt 1 ++ putUInt a1 ++ putSInt a2 ++ putUInt a3
+
+decodeBroadcast :: [Word8] -> Maybe (Broadcast, [Word8])
+decodeBroadcast bs0 =
+  do (tag, bs1) <- getUInt bs0
+     case tag of
+       1 -> do { (a1, bs2) <- getUInt bs1; (a2, bs3) <- getSInt bs2; (a3, bs4) <- getUInt bs3; return (Samples a1 a2 a3, bs4) }
+       _ -> Nothing
+
+--------------------------------------------------------------------------------
+-- union History
+
+data History
+  = Since Word32 -- seq
+  | Run Word32 Word32 [Word8] -- newest, age, samples
+ deriving ( Eq, Ord, Show )
+
+encodeHistory :: History -> [Word8]
+encodeHistory (Since a1) = putUInt 16 ++ putUInt a1
+encodeHistory (Run a1 a2 a3) = putUInt 17 ++ putUInt a1 ++ putUInt a2 ++ putBytes a3
+
+decodeHistory :: [Word8] -> Maybe (History, [Word8])
+decodeHistory bs0 =
+  do (tag, bs1) <- getUInt bs0
+     case tag of
+       16 -> do { (a1, bs2) <- getUInt bs1; return (Since a1, bs2) }
+       17 -> do { (a1, bs2) <- getUInt bs1; (a2, bs3) <- getUInt bs2; (a3, bs4) <- getBytes bs3; return (Run a1 a2 a3, bs4) }
+       _ -> Nothing
+
+--------------------------------------------------------------------------------
+-- union Msg
+
+data Msg
+  = Read
+  | Write [Word8] -- text
+ deriving ( Eq, Ord, Show )
+
+encodeMsg :: Msg -> [Word8]
+encodeMsg Read = putUInt 1
+encodeMsg (Write a1) = putUInt 2 ++ putBytes a1
+
+decodeMsg :: [Word8] -> Maybe (Msg, [Word8])
+decodeMsg bs0 =
+  do (tag, bs1) <- getUInt bs0
+     case tag of
+       1 -> do { return (Read, bs1) }
+       2 -> do { (a1, bs2) <- getBytes bs1; return (Write a1, bs2) }
+       _ -> Nothing
@@ -0,0 +1,456 @@
+module Main where
+
+import Data.Char
+import Data.List
+import System.Environment
+import System.FilePath
+
+--------------------------------------------------------------------------------
+-- wire schema generator
+--
+-- usage: runghc WireGen.hs <schema> <haskell module> <C basename>
+--
+-- example: runghc WireGen.hs example/common/wire.schema Wire.hs example/common/wire
+--
+-- generates a Haskell module and a C header/source pair with matching encoders
+-- and decoders for every union in the schema (see wire.schema for the format)
+
+--------------------------------------------------------------------------------
+-- schema
+
+data Type = UInt | SInt | Bytes
+ deriving ( Eq, Ord, Show )
+
+data Field = Field{ fieldName :: String, fieldType :: Type }
+ deriving ( Eq, Ord, Show )
+
+data Alt = Alt{ altName :: String, altTag :: Int, altFields :: [Field] }
+ deriving ( Eq, Ord, Show )
+
+data Union = Union{ unionName :: String, unionAlts :: [Alt] }
+ deriving ( Eq, Ord, Show )
+
+--------------------------------------------------------------------------------
+-- parsing
+
+tokens :: String -> [String]
+tokens []          = []
+tokens ('-':'-':s) = tokens (dropWhile (/= '\n') s)
+tokens (c:s)
+  | isSpace c           = tokens s
+  | c `elem` "{}=:;,"   = [c] : tokens s
+  | isAlphaNum c        = w : tokens s'
+  | otherwise           = error ("unexpected character " ++ show c)
+ where
+  (w,s') = span (\x -> isAlphaNum x || x == '_') (c:s)
+
+parseSchema :: [String] -> [Union]
+parseSchema []                        = []
+parseSchema ("union":name:"{":ts)     = Union name alts : parseSchema ts'
+ where
+  (alts,ts') = parseAlts ts
+parseSchema ts                        = parseError "union" ts
+
+parseAlts :: [String] -> ([Alt], [String])
+parseAlts ("}":ts) = ([], ts)
+parseAlts (name:"=":tag:"{":ts)
+  | all isDigit tag = (Alt name (read tag) fields : alts, ts'')
+ where
+  (fields,ts') = parseFields ts
+  (alts,ts'')  = parseAlts ts'
+parseAlts ts = parseError "alternative" ts
+
+parseFields :: [String] -> ([Field], [String])
+parseFields ("}":ts)               = ([], ts)
+parseFields (sep:ts)
+  | sep `elem` [";",","]           = parseFields ts
+parseFields (name:":":typ:ts)      = (Field name (parseType typ) : fields, ts')
+ where
+  (fields,ts') = parseFields ts
+parseFields ts                     = parseError "field" ts
+
+parseType :: String -> Type
+parseType "uint"  = UInt
+parseType "sint"  = SInt
+parseType "bytes" = Bytes
+parseType t       = error ("unknown type " ++ t)
+
+parseError :: String -> [String] -> a
+parseError what ts = error ("expected " ++ what ++ " at: " ++ unwords (take 5 ts))
+
+check :: [Union] -> [Union]
+check us
+  | not (null dupTypes) = error ("duplicate union " ++ head dupTypes)
+  | not (null dupTags)  = error ("duplicate tag in union " ++ head dupTags)
+  | otherwise           = us
+ where
+  dupTypes = dups (map unionName us)
+  dupTags  = [ unionName u | u <- us, not (null (dups (map altTag (unionAlts u)))) ]
+  dups xs  = [ head g | g <- group (sort xs), length g > 1 ]
+
+--------------------------------------------------------------------------------
+-- names
+
+-- WindowCommand -> window_command
+snake :: String -> String
+snake []     = []
+snake (c:cs) = toLower c : concat [ if isUpper x then ['_', toLower x] else [x] | x <- cs ]
+
+upper :: String -> String
+upper = map toUpper . snake
+
+cStruct, cTag :: Union -> String
+cStruct u = "struct wire_" ++ snake (unionName u)
+cTag u    = "WIRE_" ++ upper (unionName u)
+
+usedTypes :: [Union] -> [Type]
+usedTypes us = nub (sort [ fieldType f | u <- us, a <- unionAlts u, f <- altFields a ])
+
+--------------------------------------------------------------------------------
+-- C
+
+cType :: Type -> String
+cType UInt  = "u32_t"
+cType SInt  = "s32_t"
+cType Bytes = "struct wire_bytes"
+
+cPrim :: Type -> String
+cPrim UInt  = "uint"
+cPrim SInt  = "sint"
+cPrim Bytes = "bytes"
+
+-- the size of the largest encoding, if it is bounded
+cMaxSize :: Union -> Maybe Int
+cMaxSize u
+  | Bytes `elem` [ fieldType f | a <- unionAlts u, f <- altFields a ] = Nothing
+  | otherwise = Just (5 + maximum (0 : [ 5 * length (altFields a) | a <- unionAlts u ]))
+
+genHeader :: String -> String -> [Union] -> String
+genHeader schema base us = unlines $
+  [ "#ifndef " ++ guard
+  , "#define " ++ guard
+  , ""
+  , "/* Generated by WireGen.hs from " ++ schema ++ ", do not edit by hand."
+  , " *"
+  , " * The encoders return the number of bytes written and the decoders the"
+  , " * number of bytes consumed, or a negative error code."
+  , " */"
+  , ""
+  , "#include <zephyr/types.h>"
+  , ""
+  , "/* A view of length-prefixed bytes inside the buffer that was decoded."
+  , " * It is only valid as long as that buffer is."
+  , " */"
+  , "struct wire_bytes {"
+  , "    const u8_t* data;"
+  , "    u16_t len;"
+  , "};"
+  ] ++
+  concatMap union us ++
+  [ ""
+  , "#endif"
+  ]
+ where
+  guard = map toUpper base ++ "_BLE"
+
+  union u =
+    [ ""
+    , "/* union " ++ unionName u ++ " */"
+    , "enum wire_" ++ snake (unionName u) ++ "_tag {"
+    ] ++
+    [ "    " ++ cTag u ++ "_" ++ upper (altName a) ++ " = " ++ show (altTag a) ++ ","
+    | a <- unionAlts u
+    ] ++
+    [ "};"
+    , ""
+    , cStruct u ++ " {"
+    , "    enum wire_" ++ snake (unionName u) ++ "_tag tag;"
+    ] ++
+    (if null members then [] else ["    union {"] ++ members ++ ["    };"]) ++
+    [ "};"
+    , ""
+    ] ++
+    [ "#define " ++ cTag u ++ "_MAX_SIZE " ++ show n | Just n <- [cMaxSize u] ] ++
+    [ "int wire_encode_" ++ snake (unionName u) ++ "(const " ++ cStruct u ++ "* msg, void* buf, u16_t len);"
+    , "int wire_decode_" ++ snake (unionName u) ++ "(const void* buf, u16_t len, " ++ cStruct u ++ "* msg);"
+    ]
+   where
+    members = concat
+      [ [ "        struct {" ] ++
+        [ "            " ++ cType (fieldType f) ++ " " ++ fieldName f ++ ";" | f <- altFields a ] ++
+        [ "        } " ++ snake (altName a) ++ ";" ]
+      | a <- unionAlts u
+      , not (null (altFields a))
+      ]
+
+genSource :: String -> String -> [Union] -> String
+genSource schema base us = unlines $
+  [ "/* Generated by WireGen.hs from " ++ schema ++ ", do not edit by hand. */"
+  , ""
+  , "#include \"" ++ base ++ ".h\""
+  , ""
+  , "#include <errno.h>"
+  , "#include <string.h>"
+  , ""
+  , "struct wire_view {"
+  , "    const u8_t* p;"
+  , "    const u8_t* end;"
+  , "};"
+  , ""
+  , "struct wire_out {"
+  , "    u8_t* p;"
+  , "    u8_t* end;"
+  , "};"
+  , ""
+  , "static int put_uint(struct wire_out* o, u32_t x) {"
+  , "    do {"
+  , "        if(o->p == o->end) {"
+  , "            return -ENOMEM;"
+  , "        }"
+  , "        u8_t b = x & 0x7f;"
+  , "        x >>= 7;"
+  , "        *o->p++ = x ? (b | 0x80) : b;"
+  , "    } while(x);"
+  , "    return 0;"
+  , "}"
+  , ""
+  , "static int get_uint(struct wire_view* v, u32_t* x) {"
+  , "    u32_t res = 0;"
+  , "    for(int shift = 0; shift < 35; shift += 7) {"
+  , "        if(v->p == v->end) {"
+  , "            return -EINVAL;"
+  , "        }"
+  , "        u8_t b = *v->p++;"
+  , "        /* the fifth byte only carries bits 28 to 31 */"
+  , "        if(shift == 28 && b > 0x0f) {"
+  , "            return -EINVAL;"
+  , "        }"
+  , "        res |= (u32_t)(b & 0x7f) << shift;"
+  , "        if(!(b & 0x80)) {"
+  , "            *x = res;"
+  , "            return 0;"
+  , "        }"
+  , "    }"
+  , "    return -EINVAL;"
+  , "}"
+  ] ++
+  (if SInt `elem` types then
+  [ ""
+  , "static int put_sint(struct wire_out* o, s32_t x) {"
+  , "    return put_uint(o, ((u32_t)x << 1) ^ (u32_t)(x >> 31));"
+  , "}"
+  , ""
+  , "static int get_sint(struct wire_view* v, s32_t* x) {"
+  , "    u32_t u;"
+  , "    int err = get_uint(v, &u);"
+  , "    if(!err) {"
+  , "        *x = (s32_t)((u >> 1) ^ (0U - (u & 1)));"
+  , "    }"
+  , "    return err;"
+  , "}"
+  ] else []) ++
+  (if Bytes `elem` types then
+  [ ""
+  , "static int put_bytes(struct wire_out* o, struct wire_bytes x) {"
+  , "    int err = put_uint(o, x.len);"
+  , "    if(err) {"
+  , "        return err;"
+  , "    }"
+  , "    if(o->end - o->p < x.len) {"
+  , "        return -ENOMEM;"
+  , "    }"
+  , "    memcpy(o->p, x.data, x.len);"
+  , "    o->p += x.len;"
+  , "    return 0;"
+  , "}"
+  , ""
+  , "/* Does not copy, the result points into the decoded buffer */"
+  , "static int get_bytes(struct wire_view* v, struct wire_bytes* x) {"
+  , "    u32_t len;"
+  , "    int err = get_uint(v, &len);"
+  , "    if(err) {"
+  , "        return err;"
+  , "    }"
+  , "    if(len > (u32_t)(v->end - v->p)) {"
+  , "        return -EINVAL;"
+  , "    }"
+  , "    x->data = v->p;"
+  , "    x->len = len;"
+  , "    v->p += len;"
+  , "    return 0;"
+  , "}"
+  ] else []) ++
+  concatMap union us
+ where
+  types = usedTypes us
+
+  union u =
+    [ ""
+    , "/********** union " ++ unionName u ++ " **********/"
+    , "int wire_encode_" ++ name ++ "(const " ++ cStruct u ++ "* msg, void* buf, u16_t len) {"
+    , "    struct wire_out o = { buf, (u8_t*)buf + len };"
+    , "    int err = put_uint(&o, msg->tag);"
+    , ""
+    , "    switch(msg->tag) {"
+    ] ++
+    concat
+    [ [ "    case " ++ cTag u ++ "_" ++ upper (altName a) ++ ":" ] ++
+      [ "        err = err ? err : put_" ++ cPrim (fieldType f) ++ "(&o, msg->" ++ snake (altName a) ++ "." ++ fieldName f ++ ");"
+      | f <- altFields a
+      ] ++
+      [ "        break;" ]
+    | a <- unionAlts u
+    ] ++
+    [ "    default:"
+    , "        err = -EINVAL;"
+    , "    }"
+    , "    return err ? err : o.p - (u8_t*)buf;"
+    , "}"
+    , ""
+    , "int wire_decode_" ++ name ++ "(const void* buf, u16_t len, " ++ cStruct u ++ "* msg) {"
+    , "    struct wire_view v = { buf, (const u8_t*)buf + len };"
+    , "    u32_t tag;"
+    , "    int err = get_uint(&v, &tag);"
+    , ""
+    , "    if(err) {"
+    , "        return err;"
+    , "    }"
+    , "    msg->tag = tag;"
+    , "    switch(msg->tag) {"
+    ] ++
+    concat
+    [ [ "    case " ++ cTag u ++ "_" ++ upper (altName a) ++ ":" ] ++
+      [ "        err = err ? err : get_" ++ cPrim (fieldType f) ++ "(&v, &msg->" ++ snake (altName a) ++ "." ++ fieldName f ++ ");"
+      | f <- altFields a
+      ] ++
+      [ "        break;" ]
+    | a <- unionAlts u
+    ] ++
+    [ "    default:"
+    , "        return -EINVAL;"
+    , "    }"
+    , "    return err ? err : v.p - (const u8_t*)buf;"
+    , "}"
+    ]
+   where
+    name = snake (unionName u)
+
+--------------------------------------------------------------------------------
+-- Haskell
+
+hsType :: Type -> String
+hsType UInt  = "Word32"
+hsType SInt  = "Int32"
+hsType Bytes = "[Word8]"
+
+hsPrim :: Type -> String
+hsPrim UInt  = "UInt"
+hsPrim SInt  = "SInt"
+hsPrim Bytes = "Bytes"
+
+genHaskell :: String -> String -> [Union] -> String
+genHaskell schema modName us = unlines $
+  [ "-- Generated by WireGen.hs from " ++ schema ++ ", do not edit by hand."
+  , ""
+  , "module " ++ modName ++ " where"
+  , ""
+  , "import Data.Bits"
+  , "import Data.Int"
+  , "import Data.Word"
+  , ""
+  , "--------------------------------------------------------------------------------"
+  , "-- primitives"
+  , ""
+  , "putUInt :: Word32 -> [Word8]"
+  , "putUInt x"
+  , "  | x < 0x80  = [fromIntegral x]"
+  , "  | otherwise = (fromIntegral (x .&. 0x7f) .|. 0x80) : putUInt (x `shiftR` 7)"
+  , ""
+  , "putSInt :: Int32 -> [Word8]"
+  , "putSInt x = putUInt (fromIntegral ((x `shiftL` 1) `xor` (x `shiftR` 31)))"
+  , ""
+  , "putBytes :: [Word8] -> [Word8]"
+  , "putBytes bs = putUInt (fromIntegral (length bs)) ++ bs"
+  , ""
+  , "getUInt :: [Word8] -> Maybe (Word32, [Word8])"
+  , "getUInt = go 0 0"
+  , " where"
+  , "  go :: Int -> Word32 -> [Word8] -> Maybe (Word32, [Word8])"
+  , "  go shift acc (b:bs)"
+  , "    | shift == 28 && b > 0x0f = Nothing -- the fifth byte only carries bits 28 to 31"
+  , "    | shift < 35 && b < 0x80  = Just (acc .|. (fromIntegral b `shiftL` shift), bs)"
+  , "    | shift < 35              = go (shift+7) (acc .|. (fromIntegral (b .&. 0x7f) `shiftL` shift)) bs"
+  , "  go _ _ _ = Nothing"
+  , ""
+  , "getSInt :: [Word8] -> Maybe (Int32, [Word8])"
+  , "getSInt bs ="
+  , "  do (u, bs') <- getUInt bs"
+  , "     return (fromIntegral (u `shiftR` 1) `xor` negate (fromIntegral (u .&. 1)), bs')"
+  , ""
+  , "getBytes :: [Word8] -> Maybe ([Word8], [Word8])"
+  , "getBytes bs ="
+  , "  do (n, bs') <- getUInt bs"
+  , "     let n' = fromIntegral n"
+  , "     if length (take n' bs') == n' then Just (splitAt n' bs') else Nothing"
+  ] ++
+  concatMap union us
+ where
+  union u =
+    [ ""
+    , "--------------------------------------------------------------------------------"
+    , "-- union " ++ unionName u
+    , ""
+    , "data " ++ unionName u
+    ] ++
+    [ "  " ++ sep ++ " " ++ unwords (altName a : map (hsArg . fieldType) (altFields a)) ++ comment a
+    | (sep,a) <- zip ("=" : repeat "|") (unionAlts u)
+    ] ++
+    [ " deriving ( Eq, Ord, Show )"
+    , ""
+    , "encode" ++ unionName u ++ " :: " ++ unionName u ++ " -> [Word8]"
+    ] ++
+    [ "encode" ++ unionName u ++ " " ++ pat a ++ " = " ++
+        intercalate " ++ " (("putUInt " ++ show (altTag a)) :
+                            [ "put" ++ hsPrim (fieldType f) ++ " a" ++ show i | (i,f) <- args a ])
+    | a <- unionAlts u
+    ] ++
+    [ ""
+    , "decode" ++ unionName u ++ " :: [Word8] -> Maybe (" ++ unionName u ++ ", [Word8])"
+    , "decode" ++ unionName u ++ " bs0 ="
+    , "  do (tag, bs1) <- getUInt bs0"
+    , "     case tag of"
+    ] ++
+    [ "       " ++ show (altTag a) ++ " -> do { " ++
+        concat [ "(a" ++ show i ++ ", bs" ++ show (i+1) ++ ") <- get" ++ hsPrim (fieldType f) ++ " bs" ++ show i ++ "; "
+               | (i,f) <- args a ] ++
+        "return (" ++ unwords (altName a : [ "a" ++ show i | (i,_) <- args a ]) ++ ", bs" ++ show (length (args a) + 1) ++ ") }"
+    | a <- unionAlts u
+    ] ++
+    [ "       _ -> Nothing"
+    ]
+
+  args a = zip [1 :: Int ..] (altFields a)
+
+  pat a
+    | null (altFields a) = altName a
+    | otherwise          = "(" ++ unwords (altName a : [ "a" ++ show i | (i,_) <- args a ]) ++ ")"
+
+  hsArg t
+    | ' ' `elem` hsType t = "(" ++ hsType t ++ ")"
+    | otherwise           = hsType t
+
+  comment a
+    | null (altFields a) = ""
+    | otherwise          = " -- " ++ intercalate ", " (map fieldName (altFields a))
+
+--------------------------------------------------------------------------------
+
+main :: IO ()
+main =
+  do [schema, hsFile, cBase] <- getArgs
+     us <- (check . parseSchema . tokens) `fmap` readFile schema
+     writeFile hsFile (genHaskell (takeFileName schema) (takeBaseName hsFile) us)
+     writeFile (cBase ++ ".h") (genHeader (takeFileName schema) (takeFileName cBase) us)
+     writeFile (cBase ++ ".c") (genSource (takeFileName schema) (takeFileName cBase) us)
+
+--------------------------------------------------------------------------------
@@ -0,0 +1,182 @@
+/* batch.c - Benchmark of blexa_batch_step against blexa_step in a loop
+ *
+ * Steps n independent instances of the program for a number of ticks, once
+ * with blexa_step on an array of struct blexa_mem and once with
+ * blexa_batch_step, from the same trace of inputs, and checks that both give
+ * the same outputs. Results are written to stdout as one JSON object per
+ * instance count, see README.md.
+ */
+
+#include "blexa.h"
+#include "blexa_batch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef BENCH_REVISION
+#define BENCH_REVISION "unknown"
+#endif
+
+// ticks of inputs generated up front, the run cycles through them
+#define TRACE_TICKS 16
+
+#define MAX_VALUES 16
+
+struct sweep {
+    int values[MAX_VALUES];
+    int n;
+};
+
+static unsigned rand_state;
+
+static unsigned random_below(unsigned n) {
+    // xorshift32, the same sequence on every host
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state % n;
+}
+
+static double now_ns(void) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static void* alloc(size_t n, size_t size) {
+    void* p = calloc(n, size);
+
+    if(!p) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/* Temperatures around the threshold of 30, and octavius mostly 0 (no
+ * change), as the servers notify them
+ */
+static void make_trace(int* a, int* b, int n) {
+    for(int i = 0; i < n; i++) {
+        a[i] = 20 + random_below(21);
+        b[i] = random_below(8) < 6 ? 0 : 1 + random_below(2);
+    }
+}
+
+static void run(int n, int ticks, unsigned seed) {
+    int size = BLEXA_BATCH_SIZE(n);
+    int* a = alloc((size_t)TRACE_TICKS * size, sizeof(int));
+    int* b = alloc((size_t)TRACE_TICKS * size, sizeof(int));
+    int* scalar_out = alloc(size, sizeof(int));
+    int* batch_out = alloc(size, sizeof(int));
+    struct blexa_mem* mems = alloc(n, sizeof(struct blexa_mem));
+    struct blexa_batch batch = { alloc(size, sizeof(int)), n };
+    long checksum = 0;
+    long mismatches = 0;
+    double start, scalar_ns, batch_ns;
+
+    rand_state = seed ? seed : 1;
+    for(int t = 0; t < TRACE_TICKS; t++) {
+        make_trace(&a[t * size], &b[t * size], n);
+    }
+    for(int i = 0; i < n; i++) {
+        blexa_reset(&mems[i]);
+    }
+    blexa_batch_reset(&batch);
+
+    start = now_ns();
+    for(int t = 0; t < ticks; t++) {
+        const int* at = &a[(t % TRACE_TICKS) * size];
+        const int* bt = &b[(t % TRACE_TICKS) * size];
+
+        for(int i = 0; i < n; i++) {
+            scalar_out[i] = blexa_step(&mems[i], at[i], bt[i]);
+        }
+        checksum += scalar_out[t % n];
+    }
+    scalar_ns = now_ns() - start;
+
+    start = now_ns();
+    for(int t = 0; t < ticks; t++) {
+        const int* at = &a[(t % TRACE_TICKS) * size];
+        const int* bt = &b[(t % TRACE_TICKS) * size];
+
+        blexa_batch_step(&batch, at, bt, batch_out);
+        checksum -= batch_out[t % n];
+    }
+    batch_ns = now_ns() - start;
+
+    // both ran the same trace from the same state, so they end the same
+    for(int i = 0; i < n; i++) {
+        mismatches += scalar_out[i] != batch_out[i] || mems[i].l != batch.l[i];
+    }
+
+    double steps = (double)n * ticks;
+    printf("{\"revision\":\"%s\",\"instances\":%d,\"ticks\":%d,\"seed\":%u,"
+           "\"scalar_ns\":%g,\"batch_ns\":%g,\"speedup\":%g,"
+           "\"mismatches\":%ld,\"checksum\":%ld}\n",
+           BENCH_REVISION, n, ticks, seed, scalar_ns / steps, batch_ns / steps,
+           scalar_ns / batch_ns, mismatches, checksum);
+    fflush(stdout);
+
+    free(a);
+    free(b);
+    free(scalar_out);
+    free(batch_out);
+    free(mems);
+    free(batch.l);
+}
+
+static void parse_sweep(struct sweep* s, const char* arg, int min, int max) {
+    char* end;
+
+    s->n = 0;
+    do {
+        long v = strtol(arg, &end, 10);
+        if(end == arg || v < min || v > max || s->n == MAX_VALUES) {
+            fprintf(stderr, "bad value list '%s', values are %d..%d\n", arg, min, max);
+            exit(2);
+        }
+        s->values[s->n++] = v;
+        arg = end + 1;
+    } while(*end == ',');
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "usage: %s [-n instances] [-t steps] [-s seed]\n"
+            "\n"
+            "  -n takes a comma separated list\n"
+            "  -t is the number of instance steps per run, divided into ticks\n",
+            name);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    struct sweep instances = { { 1, 16, 256, 4096, 65536 }, 5 };
+    long steps = 1L << 26;
+    unsigned seed = 1;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:t:s:")) != -1) {
+        switch(opt) {
+        case 'n': parse_sweep(&instances, optarg, 1, 1 << 24); break;
+        case 't': steps = atol(optarg); break;
+        case 's': seed = strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]);
+        }
+    }
+    if(steps <= 0) {
+        usage(argv[0]);
+    }
+
+    for(int i = 0; i < instances.n; i++) {
+        int n = instances.values[i];
+
+        run(n, steps / n > 0 ? steps / n : 1, seed);
+    }
+    return 0;
+}
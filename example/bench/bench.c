@@ -0,0 +1,280 @@
+/* bench.c - Scale and soak benchmark of the client against simulated servers
+ *
+ * Every configuration of the sweep runs in its own process, so the static
+ * state of bt.c starts out clean and a configuration that crashes the client
+ * is reported instead of ending the sweep. Results are written to stdout as
+ * one JSON object per line, see README.md.
+ */
+
+#include "sim.h"
+#include "api.h"
+#include "runtime.h"
+#include "heapstats.h"
+
+#include <zephyr.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#ifndef BENCH_REVISION
+#define BENCH_REVISION "unknown"
+#endif
+
+#define DEVICE 0xffcc
+
+// wall clock limit of one configuration, the client may hang
+#define TIME_LIMIT_S 60
+
+#define MAX_VALUES 16
+
+struct sweep {
+    int values[MAX_VALUES];
+    int n;
+};
+
+/* From example/client/src/main.c */
+void connected(struct conn* id);
+void disconnected(struct conn* id);
+
+/* As main() of the client, but connecting to every server, and to the ones
+ * that are missing
+ */
+static void client_start(int devices) {
+    runtime_init();
+    start_bt();
+
+    register_connected_callback(connected);
+    register_disconnected_callback(disconnected);
+    for(int i = 0; i < devices; i++) {
+        try_connect(DEVICE);
+    }
+}
+
+static int compare(const void* a, const void* b) {
+    u32_t x = *(const u32_t*)a;
+    u32_t y = *(const u32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static u32_t percentile(const struct sim_samples* s, int per_mille) {
+    u32_t i = (u64_t)s->n * per_mille / 1000;
+    return s->n ? s->v[i < s->n ? i : s->n - 1] : 0;
+}
+
+static void print_percentiles(const char* name, struct sim_samples* s, double scale) {
+    qsort(s->v, s->n, sizeof(*s->v), compare);
+    printf(",\"%s\":{\"n\":%u,\"p50\":%g,\"p99\":%g,\"p999\":%g}", name, s->n,
+           percentile(s, 500) * scale, percentile(s, 990) * scale,
+           percentile(s, 999) * scale);
+}
+
+static void print_config(const struct sim_config* c) {
+    printf("{\"revision\":\"%s\",\"peripherals\":%d,\"missing\":%d,\"rate_hz\":%d,"
+           "\"payload\":%d,\"churn_ms\":%d,\"duration_s\":%d,\"heap_limit\":%d,\"seed\":%u",
+           BENCH_REVISION, c->peripherals, c->missing, c->rate_hz, c->payload, c->churn_ms,
+           c->duration_ms / 1000, c->heap_limit, c->seed);
+}
+
+/* The call sites of k_malloc with the most live bytes, see heapstats.h */
+static void print_heap_sites(void) {
+#if defined(CONFIG_APP_HEAP_TRACK)
+    struct heap_site top[HEAP_TRACK_TOP];
+    int count = heap_track_top(top, HEAP_TRACK_TOP);
+
+    printf(",\"sites\":[");
+    for(int i = 0; i < count; i++) {
+        const char* file = strrchr(top[i].file, '/');
+
+        printf("%s{\"site\":\"%s:%u\",\"live\":%u,\"peak\":%u,\"blocks\":%u,"
+               "\"allocs\":%u,\"frees\":%u,\"failures\":%u,"
+               "\"lifetime_ms\":{\"mean\":%u,\"max\":%u}}",
+               i ? "," : "", file ? file + 1 : top[i].file, top[i].line,
+               top[i].live_bytes, top[i].peak_bytes, top[i].live_blocks,
+               top[i].allocs, top[i].frees, top[i].failures,
+               top[i].frees ? (u32_t)(top[i].lifetime_total_ms / top[i].frees) : 0,
+               top[i].lifetime_max_ms);
+    }
+    printf("]");
+#endif
+}
+
+/* elapsed_ms is the virtual time that was measured, less than the duration
+ * if the client did not make it to the end
+ */
+static void print_results(const struct sim_config* c, struct sim_results* r,
+                          const char* status, s64_t elapsed_ms) {
+    u64_t dispatch_ns = 0;
+
+    for(u32_t i = 0; i < r->dispatch_ns.n; i++) {
+        dispatch_ns += r->dispatch_ns.v[i];
+    }
+
+    print_config(c);
+    printf(",\"status\":\"%s\",\"elapsed_ms\":%lld", status, (long long)elapsed_ms);
+    printf(",\"offered\":%u,\"delivered\":%u,\"recovered\":%u,\"throughput_hz\":%g",
+           r->offered, r->delivered, r->recovered,
+           elapsed_ms ? r->delivered * 1000.0 / elapsed_ms : 0.0);
+    printf(",\"lost\":{\"unconnected\":%u,\"unsubscribed\":%u}",
+           r->lost_unconnected, r->lost_unsubscribed);
+    printf(",\"dropped\":{\"queue\":%u,\"link\":%u,\"stack\":%u}",
+           r->dropped_queue, r->dropped_link, r->dropped_stack);
+    print_percentiles("latency_ms", &r->latency_us, 0.001);
+    print_percentiles("dispatch_ns", &r->dispatch_ns, 1);
+    printf(",\"dispatch_per_s\":%g",
+           dispatch_ns ? r->dispatch_ns.n * 1e9 / dispatch_ns : 0.0);
+    printf(",\"links\":{\"connects\":%u,\"failures\":%u,\"disconnects\":%u,"
+           "\"refs_leaked\":%u",
+           r->connects, r->connect_failures, r->disconnects, r->conn_refs_leaked);
+    print_percentiles("ready_ms", &r->ready_ms, 1);
+    printf("}");
+    printf(",\"radio\":{\"scan_ms\":%g,\"scan_duty\":%g,\"events_skipped\":%u,"
+           "\"skip_run_max\":%u}",
+           r->scan_us / 1000.0, elapsed_ms ? r->scan_us / (elapsed_ms * 1000.0) : 0.0,
+           r->events_skipped, r->skip_run_max);
+    printf(",\"heap\":{\"baseline\":%u,\"live\":%u,\"peak\":%u,\"allocs\":%u,"
+           "\"failures\":%u",
+           r->heap_baseline, r->heap_live, r->heap_peak, r->heap_allocs, r->heap_failures);
+    // only after the teardown is what is still live a leak
+    if(!strcmp(status, "ok")) {
+        printf(",\"leaked\":%d", (int)(r->heap_live - r->heap_baseline));
+    }
+    print_heap_sites();
+    printf("}}\n");
+}
+
+static const struct sim_config* running;
+
+/* The client crashed or hangs, report how far it got */
+static void stopped(int sig) {
+    s64_t elapsed_ms = MIN(k_uptime_get(), running->duration_ms);
+
+    print_results(running, (struct sim_results*)sim_results(),
+                  sig == SIGALRM ? "hung" : "crashed", elapsed_ms);
+    fflush(stdout);
+    _exit(3);
+}
+
+static void run(const struct sim_config* c) {
+    int signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGABRT, SIGALRM };
+
+    running = c;
+    for(int i = 0; i < ARRAY_SIZE(signals); i++) {
+        signal(signals[i], stopped);
+    }
+
+    sim_init(c);
+    client_start(c->peripherals + c->missing);
+    sim_mark_heap_baseline();
+
+    sim_run(c->duration_ms);
+    sim_teardown();
+
+    print_results(c, (struct sim_results*)sim_results(), "ok", c->duration_ms);
+}
+
+static void run_isolated(const struct sim_config* c) {
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if(pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if(!pid) {
+        alarm(TIME_LIMIT_S);
+        run(c);
+        fflush(stdout);
+        _exit(0);
+    }
+
+    if(waitpid(pid, &status, 0) < 0) {
+        perror("waitpid");
+        exit(1);
+    }
+    if(WIFSIGNALED(status)) {
+        int sig = WTERMSIG(status);
+
+        print_config(c);
+        printf(",\"status\":\"%s\",\"signal\":%d}\n",
+               sig == SIGALRM ? "hung" : "crashed", sig);
+    }
+}
+
+static void parse_sweep(struct sweep* s, const char* arg, int min, int max) {
+    char* end;
+
+    s->n = 0;
+    do {
+        long v = strtol(arg, &end, 10);
+        if(end == arg || v < min || v > max || s->n == MAX_VALUES) {
+            fprintf(stderr, "bad value list '%s', values are %d..%d\n", arg, min, max);
+            exit(2);
+        }
+        s->values[s->n++] = v;
+        arg = end + 1;
+    } while(*end == ',');
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "usage: %s [-n peripherals] [-m missing] [-r rate_hz] [-p payload]\n"
+            "          [-c churn_ms] [-d duration_s] [-H heap_limit] [-s seed] [-v]\n"
+            "\n"
+            "  -n -m -r -p -c take comma separated lists, every combination is run\n"
+            "  -H 0 lifts the limit of CONFIG_HEAP_MEM_POOL_SIZE (%d)\n"
+            "  -v prints the client's log to stderr\n",
+            name, CONFIG_HEAP_MEM_POOL_SIZE);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    struct sweep peripherals = { { 1, 2, 5, 8 }, 4 };
+    struct sweep missing = { { 0 }, 1 };
+    struct sweep rates = { { 1, 10, 100, 500 }, 4 };
+    struct sweep payloads = { { 2, 20 }, 2 };
+    struct sweep churns = { { 0, 5000 }, 2 };
+    struct sim_config c = {
+        .duration_ms = 30000,
+        .heap_limit = CONFIG_HEAP_MEM_POOL_SIZE,
+        .seed = 1,
+    };
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:m:r:p:c:d:H:s:v")) != -1) {
+        switch(opt) {
+        case 'n': parse_sweep(&peripherals, optarg, 1, 4096); break;
+        case 'm': parse_sweep(&missing, optarg, 0, 4096); break;
+        case 'r': parse_sweep(&rates, optarg, 1, 10000); break;
+        case 'p': parse_sweep(&payloads, optarg, 1, 20); break;
+        case 'c': parse_sweep(&churns, optarg, 0, 3600000); break;
+        case 'd': c.duration_ms = atoi(optarg) * 1000; break;
+        case 'H': c.heap_limit = atoi(optarg); break;
+        case 's': c.seed = strtoul(optarg, NULL, 0); break;
+        case 'v': c.verbose = true; break;
+        default: usage(argv[0]);
+        }
+    }
+    if(c.duration_ms <= 0 || c.heap_limit < 0) {
+        usage(argv[0]);
+    }
+
+    for(int n = 0; n < peripherals.n; n++)
+    for(int m = 0; m < missing.n; m++)
+    for(int r = 0; r < rates.n; r++)
+    for(int p = 0; p < payloads.n; p++)
+    for(int ch = 0; ch < churns.n; ch++) {
+        c.peripherals = peripherals.values[n];
+        c.missing = missing.values[m];
+        c.rate_hz = rates.values[r];
+        c.payload = payloads.values[p];
+        c.churn_ms = churns.values[ch];
+        run_isolated(&c);
+    }
+    return 0;
+}
@@ -0,0 +1,365 @@
+/* catchup.c - Check of the server's catch-up across a reconnect
+ *
+ * The benchmark simulates the servers, so the catch-up of
+ * ../server/src/main.c never runs there. This builds it against the stubs of
+ * include/ with a scripted stack instead. Like the stack of Zephyr 2.x, the
+ * stack here frees the runs it still holds when a link drops, without calling
+ * their callback. The check:
+ *
+ *   1. records samples, so that the catch-up needs many runs;
+ *   2. starts a catch-up on link A and lets the stack take a full window of
+ *      runs, then drops A with the runs unsent;
+ *   3. starts a catch-up on link B, which must send although A's runs never
+ *      completed;
+ *   4. completes one of A's runs late, which must not count against B;
+ *   5. sends B's runs one by one and checks that B gets every sample, in
+ *      order, without the stack ever holding more than the window.
+ *
+ * The result is written to stdout as one JSON object, see README.md, and the
+ * exit status is 1 if a step fails.
+ */
+
+#define main server_main
+#include "../server/src/main.c"
+#undef main
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifndef BENCH_REVISION
+#define BENCH_REVISION "unknown"
+#endif
+
+#define SAMPLES 40
+#define HELD    8  // runs the stack holds, more than the window
+
+/*********** Kernel ***********/
+static u32_t now_ms;
+static bool verbose;
+
+s64_t k_uptime_get(void) {
+    return now_ms;
+}
+
+u32_t k_uptime_get_32(void) {
+    return now_ms;
+}
+
+void printk(const char* fmt, ...) {
+    va_list args;
+
+    if(verbose) {
+        va_start(args, fmt);
+        vfprintf(stderr, fmt, args);
+        va_end(args);
+    }
+}
+
+static struct k_work* work_queue[2 * SENSOR_COUNT + 1];
+static int n_work;
+
+void k_work_submit(struct k_work* work) {
+    if(!work->pending && n_work < ARRAY_SIZE(work_queue)) {
+        work->pending = true;
+        work_queue[n_work++] = work;
+    }
+}
+
+/* Runs the submitted work items, as the system work queue would */
+static void run_work(void) {
+    while(n_work) {
+        struct k_work* work = work_queue[0];
+
+        n_work--;
+        memmove(work_queue, work_queue + 1, n_work * sizeof(work_queue[0]));
+        work->pending = false;
+        work->handler(work);
+    }
+}
+
+/*********** Stack ***********/
+struct bt_conn {
+    u8_t index;
+    bool up;
+    bt_addr_le_t addr;
+};
+
+static struct bt_conn links[2] = {
+    { .index = 0 },
+    { .index = 1 },
+};
+
+/* A run the stack holds until the check sends it */
+struct held {
+    struct bt_conn* conn;
+    bt_gatt_complete_func_t func;
+    void* user_data;
+    u8_t data[RUN_MAX];
+    u16_t len;
+};
+
+static struct held held[HELD];
+static int n_held;
+static int max_held;
+
+struct link_stats link_stats[CONFIG_BT_MAX_CONN];
+
+void link_stats_init(void) {
+}
+
+struct bt_conn* bt_conn_ref(struct bt_conn* conn) {
+    return conn;
+}
+
+void bt_conn_unref(struct bt_conn* conn) {
+}
+
+u8_t bt_conn_index(struct bt_conn* conn) {
+    return conn->index;
+}
+
+const bt_addr_le_t* bt_conn_get_dst(const struct bt_conn* conn) {
+    return &conn->addr;
+}
+
+int bt_gatt_notify_cb(struct bt_conn* conn, struct bt_gatt_notify_params* params) {
+    if(!conn->up) {
+        return -ENOTCONN;
+    }
+    if(n_held == HELD || params->len > RUN_MAX) {
+        return -ENOMEM;
+    }
+
+    struct held* h = &held[n_held++];
+    h->conn = conn;
+    h->func = params->func;
+    h->user_data = params->user_data;
+    memcpy(h->data, params->data, params->len);
+    h->len = params->len;
+    max_held = MAX(max_held, n_held);
+    return 0;
+}
+
+int bt_gatt_notify(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                   const void* data, u16_t len) {
+    return 0;
+}
+
+bool bt_gatt_is_subscribed(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                           u16_t ccc_value) {
+    return conn && conn->up;
+}
+
+u16_t bt_gatt_get_mtu(struct bt_conn* conn) {
+    return CONFIG_BT_L2CAP_TX_MTU;
+}
+
+/* The link drops, the stack frees what it holds for it without a callback */
+static void drop(struct bt_conn* conn) {
+    int kept = 0;
+
+    conn->up = false;
+    for(int i = 0; i < n_held; i++) {
+        if(held[i].conn != conn) {
+            held[kept++] = held[i];
+        }
+    }
+    n_held = kept;
+    catch_up_disconnected(conn);
+}
+
+/* Takes the oldest run the stack holds for conn, without sending it */
+static bool take(struct bt_conn* conn, struct held* out) {
+    for(int i = 0; i < n_held; i++) {
+        if(held[i].conn == conn) {
+            *out = held[i];
+            n_held--;
+            memmove(&held[i], &held[i + 1], (n_held - i) * sizeof(held[0]));
+            return true;
+        }
+    }
+    return false;
+}
+
+static int runs_of(struct bt_conn* conn) {
+    int n = 0;
+
+    for(int i = 0; i < n_held; i++) {
+        n += held[i].conn == conn;
+    }
+    return n;
+}
+
+/* Not used by the catch-up, the server only refers to them */
+ssize_t bt_gatt_attr_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                          void* buf, u16_t buf_len, u16_t offset,
+                          const void* value, u16_t value_len) {
+    return -ENOTSUP;
+}
+
+ssize_t bt_gatt_attr_read_service(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                  void* buf, u16_t len, u16_t offset) {
+    return -ENOTSUP;
+}
+
+ssize_t bt_gatt_attr_read_chrc(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                               void* buf, u16_t len, u16_t offset) {
+    return -ENOTSUP;
+}
+
+int bt_enable(bt_ready_cb_t cb) {
+    return -ENOTSUP;
+}
+
+int settings_load(void) {
+    return -ENOTSUP;
+}
+
+int bt_le_adv_start(const struct bt_le_adv_param* param,
+                    const struct bt_data* ad, size_t ad_len,
+                    const struct bt_data* sd, size_t sd_len) {
+    return -ENOTSUP;
+}
+
+int bt_le_ext_adv_create(const struct bt_le_adv_param* param,
+                         const struct bt_le_ext_adv_cb* cb,
+                         struct bt_le_ext_adv** adv) {
+    return -ENOTSUP;
+}
+
+int bt_le_ext_adv_set_data(struct bt_le_ext_adv* adv,
+                           const struct bt_data* ad, size_t ad_len,
+                           const struct bt_data* sd, size_t sd_len) {
+    return -ENOTSUP;
+}
+
+int bt_le_ext_adv_start(struct bt_le_ext_adv* adv,
+                        struct bt_le_ext_adv_start_param* param) {
+    return -ENOTSUP;
+}
+
+void bt_conn_cb_register(struct bt_conn_cb* cb) {
+}
+
+int bt_conn_auth_cb_register(const struct bt_conn_auth_cb* cb) {
+    return -ENOTSUP;
+}
+
+int bt_addr_le_to_str(const bt_addr_le_t* addr, char* str, size_t len) {
+    return snprintf(str, len, "link");
+}
+
+/*********** Check ***********/
+static const struct bt_gatt_attr* attr;
+
+/* The client writes History.Since on conn */
+static ssize_t since(struct bt_conn* conn, u32_t seq) {
+    struct wire_history h = { .tag = WIRE_HISTORY_SINCE };
+    u8_t buf[16];
+    int len;
+
+    h.since.seq = seq;
+    len = wire_encode_history(&h, buf, sizeof(buf));
+    conn->up = true;
+    return write_since(conn, attr, buf, len, 0, 0);
+}
+
+/* Counts the samples of a run, and checks they follow *expect */
+static bool unpack(const struct held* run, u32_t* expect) {
+    struct wire_history h;
+
+    if(wire_decode_history(run->data, run->len, &h) < 0 ||
+       h.tag != WIRE_HISTORY_RUN) {
+        return false;
+    }
+
+    const u8_t* p = h.run.samples.data;
+    const u8_t* end = p + h.run.samples.len;
+    while(p < end) {
+        struct wire_sample s;
+        int len = wire_decode_sample(p, end - p, &s);
+
+        if(len <= 0 || s.tag != WIRE_SAMPLE_TEMPERATURE ||
+           s.temperature.seq != *expect) {
+            return false;
+        }
+        (*expect)++;
+        p += len;
+    }
+    return true;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "usage: %s [-v]\n"
+            "\n"
+            "  -v prints what the server prints, to stderr\n",
+            name);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    struct bt_conn* a = &links[0];
+    struct bt_conn* b = &links[1];
+    struct held run, late[HELD];
+    int n_late = 0;
+    u32_t expect = 1;
+    int opt;
+
+    while((opt = getopt(argc, argv, "v")) != -1) {
+        switch(opt) {
+        case 'v': verbose = true; break;
+        default: usage(argv[0]);
+        }
+    }
+
+    attr = sensor_attr(SENSOR_temperature);
+    for(int i = 1; i <= SAMPLES; i++) {
+        now_ms += 100;
+        bt_gatt_set_temperature(i);
+        run_work();
+    }
+
+    // 2: a full window on A, then A drops with it unsent
+    since(a, 0);
+    run_work();
+    int runs_a = runs_of(a);
+    while(n_late < runs_a && take(a, &late[n_late])) {
+        n_late++;
+    }
+    drop(a);
+
+    // 3: B must get runs although A's never completed
+    since(b, 0);
+    run_work();
+    int runs_b = runs_of(b);
+
+    // 4: a run of A completes late, it must not free a place of B's window
+    late[0].func(a, late[0].user_data);
+    run_work();
+    bool late_ignored = runs_of(b) == runs_b;
+
+    // 5: the rest of the catch-up, one run at a time
+    bool in_order = true;
+    int runs = 0;
+    while(take(b, &run)) {
+        in_order = in_order && unpack(&run, &expect);
+        runs++;
+        run.func(b, run.user_data);
+        run_work();
+    }
+
+    u32_t received = expect - 1;
+    bool ok = runs_a == CATCH_UP_WINDOW && runs_b > 0 && late_ignored &&
+              in_order && received == SAMPLES && max_held <= CATCH_UP_WINDOW;
+    printf("{\"revision\":\"%s\",\"samples\":%d,\"window\":%d,"
+           "\"runs_a\":%d,\"runs_b\":%d,\"late_ignored\":%s,"
+           "\"runs\":%d,\"received\":%u,\"in_order\":%s,\"max_held\":%d,"
+           "\"status\":\"%s\"}\n",
+           BENCH_REVISION, SAMPLES, CATCH_UP_WINDOW, runs_a, runs_b,
+           late_ignored ? "true" : "false", runs, received,
+           in_order ? "true" : "false", max_held, ok ? "ok" : "failed");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,9 @@
+#ifndef BENCH_BLUETOOTH_ATT_H
+#define BENCH_BLUETOOTH_ATT_H
+
+#define BT_ATT_ERR_WRITE_NOT_PERMITTED 0x03
+#define BT_ATT_ERR_INVALID_OFFSET      0x07
+#define BT_ATT_ERR_UNLIKELY            0x0e
+#define BT_ATT_ERR_VALUE_NOT_ALLOWED   0x13
+
+#endif
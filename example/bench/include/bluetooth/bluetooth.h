@@ -0,0 +1,169 @@
+#ifndef BENCH_BLUETOOTH_H
+#define BENCH_BLUETOOTH_H
+
+/* Host shim of the Bluetooth host API, implemented by the simulated
+ * controller in sim.c. Only what the client uses is declared, and what
+ * catchup.c needs to build the server.
+ */
+
+#include <zephyr/types.h>
+#include <stdbool.h>
+#include <string.h>
+#include <zephyr.h>
+#include <sys/byteorder.h>
+
+typedef struct {
+    u8_t val[6];
+} bt_addr_t;
+
+typedef struct {
+    u8_t type;
+    bt_addr_t a;
+} bt_addr_le_t;
+
+#define BT_ADDR_LE_PUBLIC  0x00
+#define BT_ADDR_LE_RANDOM  0x01
+#define BT_ADDR_LE_STR_LEN 30
+#define BT_ID_DEFAULT      0
+
+int bt_addr_le_to_str(const bt_addr_le_t* addr, char* str, size_t len);
+
+static inline int bt_addr_le_cmp(const bt_addr_le_t* a, const bt_addr_le_t* b) {
+    return memcmp(a, b, sizeof(*a));
+}
+
+static inline void bt_addr_le_copy(bt_addr_le_t* dst, const bt_addr_le_t* src) {
+    memcpy(dst, src, sizeof(*dst));
+}
+
+struct net_buf_simple {
+    u8_t* data;
+    u16_t len;
+    u16_t size;
+    u8_t* __buf;
+};
+
+struct net_buf_simple_state {
+    u16_t offset;
+    u16_t len;
+};
+
+void net_buf_simple_save(struct net_buf_simple* buf, struct net_buf_simple_state* state);
+void net_buf_simple_restore(struct net_buf_simple* buf, struct net_buf_simple_state* state);
+
+struct bt_data {
+    u8_t type;
+    u8_t data_len;
+    const u8_t* data;
+};
+
+#define BT_DATA(_type, _data, _data_len) \
+    { .type = (_type), .data_len = (_data_len), .data = (const u8_t*)(_data) }
+#define BT_DATA_BYTES(_type, _bytes...) \
+    BT_DATA(_type, ((u8_t[]){_bytes}), sizeof((u8_t[]){_bytes}))
+
+#define BT_DATA_FLAGS        0x01
+#define BT_DATA_UUID16_SOME  0x02
+#define BT_DATA_UUID16_ALL   0x03
+#define BT_DATA_SVC_DATA16   0x16
+
+#define BT_LE_AD_GENERAL     0x02
+#define BT_LE_AD_NO_BREDR    0x04
+
+void bt_data_parse(struct net_buf_simple* ad,
+                   bool (*func)(struct bt_data* data, void* user_data),
+                   void* user_data);
+
+typedef void bt_ready_cb_t(int err);
+int bt_enable(bt_ready_cb_t cb);
+
+#define BT_GAP_ADV_TYPE_ADV_IND         0x00
+#define BT_GAP_ADV_TYPE_ADV_DIRECT_IND  0x01
+#define BT_GAP_ADV_TYPE_ADV_SCAN_IND    0x02
+#define BT_GAP_ADV_TYPE_ADV_NONCONN_IND 0x03
+#define BT_GAP_ADV_TYPE_SCAN_RSP        0x04
+
+#define BT_GAP_SCAN_FAST_INTERVAL   0x0060
+#define BT_GAP_SCAN_FAST_WINDOW     0x0030
+#define BT_GAP_SCAN_SLOW_INTERVAL_1 0x0800
+#define BT_GAP_SCAN_SLOW_WINDOW_1   0x0012
+
+enum {
+    BT_LE_SCAN_TYPE_PASSIVE = 0x00,
+    BT_LE_SCAN_TYPE_ACTIVE = 0x01,
+};
+
+enum {
+    BT_LE_SCAN_OPT_NONE = 0,
+    BT_LE_SCAN_OPT_FILTER_DUPLICATE = BIT(0),
+};
+
+struct bt_le_scan_param {
+    u8_t type;
+    u32_t options;
+    u16_t interval; // units of 0.625 ms
+    u16_t window;   // units of 0.625 ms
+    u16_t timeout;
+    u16_t interval_coded;
+    u16_t window_coded;
+};
+
+typedef void bt_le_scan_cb_t(const bt_addr_le_t* addr, s8_t rssi, u8_t adv_type,
+                             struct net_buf_simple* buf);
+
+int bt_le_scan_start(const struct bt_le_scan_param* param, bt_le_scan_cb_t cb);
+int bt_le_scan_stop(void);
+
+/* Advertising, only the server uses it */
+#define BT_GAP_ADV_FAST_INT_MIN_2 0x00a0
+#define BT_GAP_ADV_FAST_INT_MAX_2 0x00f0
+
+enum {
+    BT_LE_ADV_OPT_NONE = 0,
+    BT_LE_ADV_OPT_CONNECTABLE = BIT(0),
+    BT_LE_ADV_OPT_USE_NAME = BIT(3),
+    BT_LE_ADV_OPT_EXT_ADV = BIT(10),
+};
+
+struct bt_le_adv_param {
+    u8_t id;
+    u32_t options;
+    u32_t interval_min;
+    u32_t interval_max;
+    const bt_addr_le_t* peer;
+};
+
+#define BT_LE_ADV_PARAM(_options, _int_min, _int_max, _peer) \
+    ((struct bt_le_adv_param[]){{ .options = (_options), \
+                                  .interval_min = (_int_min), \
+                                  .interval_max = (_int_max), \
+                                  .peer = (_peer) }})
+#define BT_LE_ADV_CONN_NAME \
+    BT_LE_ADV_PARAM(BT_LE_ADV_OPT_CONNECTABLE | BT_LE_ADV_OPT_USE_NAME, \
+                    BT_GAP_ADV_FAST_INT_MIN_2, BT_GAP_ADV_FAST_INT_MAX_2, NULL)
+
+int bt_le_adv_start(const struct bt_le_adv_param* param,
+                    const struct bt_data* ad, size_t ad_len,
+                    const struct bt_data* sd, size_t sd_len);
+
+struct bt_le_ext_adv;
+struct bt_le_ext_adv_cb;
+
+struct bt_le_ext_adv_start_param {
+    u16_t timeout;
+    u8_t num_events;
+};
+
+#define BT_LE_EXT_ADV_START_DEFAULT \
+    ((struct bt_le_ext_adv_start_param[]){{ .timeout = 0, .num_events = 0 }})
+
+int bt_le_ext_adv_create(const struct bt_le_adv_param* param,
+                         const struct bt_le_ext_adv_cb* cb,
+                         struct bt_le_ext_adv** adv);
+int bt_le_ext_adv_set_data(struct bt_le_ext_adv* adv,
+                           const struct bt_data* ad, size_t ad_len,
+                           const struct bt_data* sd, size_t sd_len);
+int bt_le_ext_adv_start(struct bt_le_ext_adv* adv,
+                        struct bt_le_ext_adv_start_param* param);
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef BENCH_BLUETOOTH_CONN_H
+#define BENCH_BLUETOOTH_CONN_H
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+
+/* Defined by the simulated controller, the client only holds pointers */
+struct bt_conn;
+
+struct bt_le_conn_param {
+    u16_t interval_min;
+    u16_t interval_max;
+    u16_t latency;
+    u16_t timeout;
+};
+
+#define BT_LE_CONN_PARAM_INIT(int_min, int_max, lat, to) \
+    { .interval_min = (int_min), .interval_max = (int_max), \
+      .latency = (lat), .timeout = (to) }
+#define BT_LE_CONN_PARAM(int_min, int_max, lat, to) \
+    ((struct bt_le_conn_param[]){BT_LE_CONN_PARAM_INIT(int_min, int_max, lat, to)})
+#define BT_LE_CONN_PARAM_DEFAULT BT_LE_CONN_PARAM(0x18, 0x28, 0, 400)
+
+struct bt_conn* bt_conn_ref(struct bt_conn* conn);
+void bt_conn_unref(struct bt_conn* conn);
+u8_t bt_conn_index(struct bt_conn* conn);
+const bt_addr_le_t* bt_conn_get_dst(const struct bt_conn* conn);
+struct bt_conn* bt_conn_lookup_addr_le(u8_t id, const bt_addr_le_t* peer);
+int bt_conn_disconnect(struct bt_conn* conn, u8_t reason);
+
+enum {
+    BT_CONN_LE_OPT_NONE = 0,
+};
+
+struct bt_conn_le_create_param {
+    u32_t options;
+    u16_t interval;
+    u16_t window;
+    u16_t interval_coded;
+    u16_t window_coded;
+    u16_t timeout; // units of 10 ms, 0 is CONFIG_BT_CREATE_CONN_TIMEOUT
+};
+
+#define BT_CONN_LE_CREATE_PARAM_INIT(_options, _interval, _window) \
+    { .options = (_options), .interval = (_interval), .window = (_window), \
+      .interval_coded = 0, .window_coded = 0, .timeout = 0 }
+#define BT_CONN_LE_CREATE_PARAM(_options, _interval, _window) \
+    ((struct bt_conn_le_create_param[]){ \
+        BT_CONN_LE_CREATE_PARAM_INIT(_options, _interval, _window)})
+#define BT_CONN_LE_CREATE_CONN \
+    BT_CONN_LE_CREATE_PARAM(BT_CONN_LE_OPT_NONE, BT_GAP_SCAN_FAST_INTERVAL, \
+                            BT_GAP_SCAN_FAST_INTERVAL)
+
+int bt_conn_le_create(const bt_addr_le_t* peer,
+                      const struct bt_conn_le_create_param* create_param,
+                      const struct bt_le_conn_param* conn_param,
+                      struct bt_conn** conn);
+
+typedef enum {
+    BT_SECURITY_L0,
+    BT_SECURITY_L1,
+    BT_SECURITY_L2,
+    BT_SECURITY_L3,
+    BT_SECURITY_L4,
+} bt_security_t;
+
+enum bt_security_err {
+    BT_SECURITY_ERR_SUCCESS,
+    BT_SECURITY_ERR_AUTH_FAIL,
+    BT_SECURITY_ERR_PIN_OR_KEY_MISSING,
+    BT_SECURITY_ERR_OOB_NOT_AVAILABLE,
+    BT_SECURITY_ERR_AUTH_REQUIREMENT,
+    BT_SECURITY_ERR_PAIR_NOT_SUPPORTED,
+    BT_SECURITY_ERR_PAIR_NOT_ALLOWED,
+    BT_SECURITY_ERR_INVALID_PARAM,
+    BT_SECURITY_ERR_UNSPECIFIED,
+};
+
+int bt_conn_set_security(struct bt_conn* conn, bt_security_t sec);
+
+struct bt_conn_le_info {
+    const bt_addr_le_t* src;
+    const bt_addr_le_t* dst;
+    const bt_addr_le_t* local;
+    const bt_addr_le_t* remote;
+    u16_t interval;
+    u16_t latency;
+    u16_t timeout;
+};
+
+enum {
+    BT_CONN_ROLE_MASTER,
+    BT_CONN_ROLE_SLAVE,
+};
+
+struct bt_conn_info {
+    u8_t type;
+    u8_t role;
+    u8_t id;
+    union {
+        struct bt_conn_le_info le;
+    };
+};
+
+int bt_conn_get_info(const struct bt_conn* conn, struct bt_conn_info* info);
+
+struct bt_conn_cb {
+    void (*connected)(struct bt_conn* conn, u8_t err);
+    void (*disconnected)(struct bt_conn* conn, u8_t reason);
+    bool (*le_param_req)(struct bt_conn* conn, struct bt_le_conn_param* param);
+    void (*le_param_updated)(struct bt_conn* conn, u16_t interval,
+                             u16_t latency, u16_t timeout);
+    void (*identity_resolved)(struct bt_conn* conn, const bt_addr_le_t* rpa,
+                              const bt_addr_le_t* identity);
+    void (*security_changed)(struct bt_conn* conn, bt_security_t level,
+                             enum bt_security_err err);
+    struct bt_conn_cb* _next;
+};
+
+void bt_conn_cb_register(struct bt_conn_cb* cb);
+
+struct bt_conn_auth_cb {
+    void (*cancel)(struct bt_conn* conn);
+    void (*pairing_complete)(struct bt_conn* conn, bool bonded);
+    void (*pairing_failed)(struct bt_conn* conn, enum bt_security_err reason);
+};
+
+int bt_conn_auth_cb_register(const struct bt_conn_auth_cb* cb);
+
+struct bt_bond_info {
+    bt_addr_le_t addr;
+};
+
+void bt_foreach_bond(u8_t id, void (*func)(const struct bt_bond_info* info, void* user_data),
+                     void* user_data);
+int bt_unpair(u8_t id, const bt_addr_le_t* addr);
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef BENCH_BLUETOOTH_GATT_H
+#define BENCH_BLUETOOTH_GATT_H
+
+#include <sys/types.h>
+#include <sys/atomic.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/uuid.h>
+#include <bluetooth/att.h>
+
+struct bt_gatt_attr;
+
+typedef ssize_t (*bt_gatt_attr_read_func_t)(struct bt_conn* conn,
+                                            const struct bt_gatt_attr* attr,
+                                            void* buf, u16_t len, u16_t offset);
+typedef ssize_t (*bt_gatt_attr_write_func_t)(struct bt_conn* conn,
+                                             const struct bt_gatt_attr* attr,
+                                             const void* buf, u16_t len,
+                                             u16_t offset, u8_t flags);
+
+struct bt_gatt_attr {
+    const struct bt_uuid* uuid;
+    bt_gatt_attr_read_func_t read;
+    bt_gatt_attr_write_func_t write;
+    void* user_data;
+    u16_t handle;
+    u8_t perm;
+};
+
+struct bt_gatt_service_static {
+    const struct bt_gatt_attr* attrs;
+    size_t attr_count;
+};
+
+struct bt_gatt_service_val {
+    const struct bt_uuid* uuid;
+    u16_t end_handle;
+};
+
+struct bt_gatt_chrc {
+    const struct bt_uuid* uuid;
+    u16_t value_handle;
+    u8_t properties;
+};
+
+#define BT_GATT_PERM_NONE  0
+#define BT_GATT_PERM_READ  BIT(0)
+#define BT_GATT_PERM_WRITE BIT(1)
+
+#define BT_GATT_CHRC_READ   0x02
+#define BT_GATT_CHRC_WRITE  0x08
+#define BT_GATT_CHRC_NOTIFY 0x10
+
+#define BT_GATT_CCC_NOTIFY 0x0001
+
+#define BT_GATT_ITER_STOP     0
+#define BT_GATT_ITER_CONTINUE 1
+
+ssize_t bt_gatt_attr_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                          void* buf, u16_t buf_len, u16_t offset,
+                          const void* value, u16_t value_len);
+ssize_t bt_gatt_attr_read_service(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                  void* buf, u16_t len, u16_t offset);
+ssize_t bt_gatt_attr_read_chrc(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                               void* buf, u16_t len, u16_t offset);
+
+/* Local services are declared so the shared code compiles, the simulated
+ * peripherals have their own attribute tables.
+ */
+#define BT_GATT_ATTRIBUTE(_uuid, _perm, _read, _write, _value) \
+    { .uuid = _uuid, .read = _read, .write = _write, .user_data = _value, \
+      .handle = 0, .perm = _perm }
+#define BT_GATT_PRIMARY_SERVICE(_service) \
+    BT_GATT_ATTRIBUTE(BT_UUID_GATT_PRIMARY, BT_GATT_PERM_READ, \
+                      bt_gatt_attr_read_service, NULL, _service)
+#define BT_GATT_CHARACTERISTIC(_uuid, _props, _perm, _read, _write, _value) \
+    BT_GATT_ATTRIBUTE(BT_UUID_GATT_CHRC, BT_GATT_PERM_READ, \
+                      bt_gatt_attr_read_chrc, NULL, \
+                      ((struct bt_gatt_chrc[]){{ .uuid = _uuid, \
+                                                 .value_handle = 0U, \
+                                                 .properties = _props }})), \
+    BT_GATT_ATTRIBUTE(_uuid, _perm, _read, _write, _value)
+#define BT_GATT_ERR(_att_err) (-(_att_err))
+
+struct _bt_gatt_ccc {
+    u16_t value;
+    void (*cfg_changed)(const struct bt_gatt_attr* attr, u16_t value);
+};
+
+#define BT_GATT_CCC(_changed, _perm) \
+    BT_GATT_ATTRIBUTE(BT_UUID_GATT_CCC, _perm, NULL, NULL, \
+                      ((struct _bt_gatt_ccc[]){{ .cfg_changed = _changed }}))
+#define BT_GATT_SERVICE_DEFINE(_name, ...) \
+    const struct bt_gatt_attr attr_##_name[] = { __VA_ARGS__ }; \
+    const struct bt_gatt_service_static _name = { \
+        .attrs = attr_##_name, .attr_count = ARRAY_SIZE(attr_##_name) }
+
+u16_t bt_gatt_attr_value_handle(const struct bt_gatt_attr* attr);
+
+/* The server side, for catchup.c */
+typedef void (*bt_gatt_complete_func_t)(struct bt_conn* conn, void* user_data);
+
+struct bt_gatt_notify_params {
+    const struct bt_uuid* uuid;
+    const struct bt_gatt_attr* attr;
+    const void* data;
+    u16_t len;
+    bt_gatt_complete_func_t func;
+    void* user_data;
+};
+
+int bt_gatt_notify_cb(struct bt_conn* conn, struct bt_gatt_notify_params* params);
+int bt_gatt_notify(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                   const void* data, u16_t len);
+bool bt_gatt_is_subscribed(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                           u16_t ccc_value);
+u16_t bt_gatt_get_mtu(struct bt_conn* conn);
+
+enum {
+    BT_GATT_DISCOVER_PRIMARY,
+    BT_GATT_DISCOVER_SECONDARY,
+    BT_GATT_DISCOVER_INCLUDE,
+    BT_GATT_DISCOVER_CHARACTERISTIC,
+    BT_GATT_DISCOVER_DESCRIPTOR,
+};
+
+struct bt_gatt_discover_params;
+
+typedef u8_t (*bt_gatt_discover_func_t)(struct bt_conn* conn,
+                                        const struct bt_gatt_attr* attr,
+                                        struct bt_gatt_discover_params* params);
+
+struct bt_gatt_discover_params {
+    struct bt_uuid* uuid;
+    bt_gatt_discover_func_t func;
+    u16_t start_handle;
+    u16_t end_handle;
+    u8_t type;
+};
+
+int bt_gatt_discover(struct bt_conn* conn, struct bt_gatt_discover_params* params);
+
+struct bt_gatt_subscribe_params;
+
+typedef u8_t (*bt_gatt_notify_func_t)(struct bt_conn* conn,
+                                      struct bt_gatt_subscribe_params* params,
+                                      const void* data, u16_t length);
+
+enum {
+    BT_GATT_SUBSCRIBE_FLAG_VOLATILE,
+    BT_GATT_SUBSCRIBE_FLAG_NO_RESUB,
+    BT_GATT_SUBSCRIBE_FLAG_WRITE_PENDING,
+    BT_GATT_SUBSCRIBE_NUM_FLAGS,
+};
+
+struct bt_gatt_subscribe_params {
+    bt_gatt_notify_func_t notify;
+    u16_t value_handle;
+    u16_t ccc_handle;
+    u16_t value;
+    ATOMIC_DEFINE(flags, BT_GATT_SUBSCRIBE_NUM_FLAGS);
+};
+
+int bt_gatt_subscribe(struct bt_conn* conn, struct bt_gatt_subscribe_params* params);
+int bt_gatt_unsubscribe(struct bt_conn* conn, struct bt_gatt_subscribe_params* params);
+
+struct bt_gatt_write_params;
+
+typedef void (*bt_gatt_write_func_t)(struct bt_conn* conn, u8_t err,
+                                     struct bt_gatt_write_params* params);
+
+struct bt_gatt_write_params {
+    bt_gatt_write_func_t func;
+    u16_t handle;
+    u16_t offset;
+    const void* data;
+    u16_t length;
+};
+
+int bt_gatt_write(struct bt_conn* conn, struct bt_gatt_write_params* params);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef BENCH_BLUETOOTH_HCI_H
+#define BENCH_BLUETOOTH_HCI_H
+
+#include <bluetooth/bluetooth.h>
+
+#define BT_HCI_ERR_UNKNOWN_CONN_ID       0x02
+#define BT_HCI_ERR_PIN_OR_KEY_MISSING    0x06
+#define BT_HCI_ERR_REMOTE_USER_TERM_CONN 0x13
+#define BT_HCI_ERR_LOCALHOST_TERM_CONN   0x16
+#define BT_HCI_ERR_UNSPECIFIED           0x1f
+
+#endif
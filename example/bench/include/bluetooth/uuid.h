@@ -0,0 +1,29 @@
+#ifndef BENCH_BLUETOOTH_UUID_H
+#define BENCH_BLUETOOTH_UUID_H
+
+#include <zephyr/types.h>
+
+/* 16 bit uuids only */
+struct bt_uuid {
+    u8_t type;
+};
+
+struct bt_uuid_16 {
+    struct bt_uuid uuid;
+    u16_t val;
+};
+
+#define BT_UUID_TYPE_16 0
+
+#define BT_UUID_INIT_16(value) { .uuid = { BT_UUID_TYPE_16 }, .val = (value) }
+#define BT_UUID_DECLARE_16(value) \
+    ((struct bt_uuid*)((struct bt_uuid_16[]){BT_UUID_INIT_16(value)}))
+#define BT_UUID_16(__u) ((struct bt_uuid_16*)(__u))
+
+int bt_uuid_cmp(const struct bt_uuid* u1, const struct bt_uuid* u2);
+
+#define BT_UUID_GATT_PRIMARY BT_UUID_DECLARE_16(0x2800)
+#define BT_UUID_GATT_CHRC    BT_UUID_DECLARE_16(0x2803)
+#define BT_UUID_GATT_CCC     BT_UUID_DECLARE_16(0x2902)
+
+#endif
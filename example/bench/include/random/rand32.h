@@ -0,0 +1,9 @@
+#ifndef BENCH_RANDOM_RAND32_H
+#define BENCH_RANDOM_RAND32_H
+
+#include <zephyr/types.h>
+
+/* Seeded per configuration, so every run of a configuration is the same */
+u32_t sys_rand32_get(void);
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef BENCH_SETTINGS_H
+#define BENCH_SETTINGS_H
+
+/* Bonds live in the simulated controller, there is nothing to load */
+int settings_load(void);
+
+#endif
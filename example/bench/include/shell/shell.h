@@ -0,0 +1,13 @@
+#ifndef BENCH_SHELL_H
+#define BENCH_SHELL_H
+
+#include <stddef.h>
+
+/* The benchmark is built without CONFIG_SHELL, the commands compile away */
+struct shell;
+
+void shell_print(const struct shell* shell, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+#define shell_error shell_print
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef BENCH_SYS_ATOMIC_H
+#define BENCH_SYS_ATOMIC_H
+
+#include <stdbool.h>
+
+typedef int atomic_t;
+typedef atomic_t atomic_val_t;
+
+#define ATOMIC_INIT(i) (i)
+
+static inline atomic_val_t atomic_add(atomic_t* t, atomic_val_t v) {
+    return __atomic_fetch_add(t, v, __ATOMIC_SEQ_CST);
+}
+
+static inline atomic_val_t atomic_sub(atomic_t* t, atomic_val_t v) {
+    return __atomic_fetch_sub(t, v, __ATOMIC_SEQ_CST);
+}
+
+static inline atomic_val_t atomic_inc(atomic_t* t) {
+    return atomic_add(t, 1);
+}
+
+static inline atomic_val_t atomic_dec(atomic_t* t) {
+    return atomic_sub(t, 1);
+}
+
+static inline atomic_val_t atomic_get(const atomic_t* t) {
+    return __atomic_load_n(t, __ATOMIC_SEQ_CST);
+}
+
+static inline atomic_val_t atomic_set(atomic_t* t, atomic_val_t v) {
+    return __atomic_exchange_n(t, v, __ATOMIC_SEQ_CST);
+}
+
+static inline atomic_val_t atomic_clear(atomic_t* t) {
+    return atomic_set(t, 0);
+}
+
+static inline bool atomic_cas(atomic_t* t, atomic_val_t old, atomic_val_t v) {
+    return __atomic_compare_exchange_n(t, &old, v, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#define ATOMIC_BITS (sizeof(atomic_val_t) * 8)
+#define ATOMIC_DEFINE(name, num_bits) \
+    atomic_t name[1 + ((num_bits) - 1) / ATOMIC_BITS]
+
+static inline void atomic_set_bit(atomic_t* target, int bit) {
+    __atomic_fetch_or(&target[bit / ATOMIC_BITS], 1 << (bit % ATOMIC_BITS),
+                      __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_clear_bit(atomic_t* target, int bit) {
+    __atomic_fetch_and(&target[bit / ATOMIC_BITS], ~(1 << (bit % ATOMIC_BITS)),
+                       __ATOMIC_SEQ_CST);
+}
+
+static inline bool atomic_test_bit(const atomic_t* target, int bit) {
+    return (atomic_get(&target[bit / ATOMIC_BITS]) >> (bit % ATOMIC_BITS)) & 1;
+}
+
+static inline bool atomic_test_and_clear_bit(atomic_t* target, int bit) {
+    atomic_val_t mask = 1 << (bit % ATOMIC_BITS);
+
+    return __atomic_fetch_and(&target[bit / ATOMIC_BITS], ~mask, __ATOMIC_SEQ_CST) & mask;
+}
+
+static inline bool atomic_test_and_set_bit(atomic_t* target, int bit) {
+    atomic_val_t mask = 1 << (bit % ATOMIC_BITS);
+
+    return __atomic_fetch_or(&target[bit / ATOMIC_BITS], mask, __ATOMIC_SEQ_CST) & mask;
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef BENCH_SYS_BYTEORDER_H
+#define BENCH_SYS_BYTEORDER_H
+
+#include <zephyr/types.h>
+
+/* The hosts we run on are little endian, like the nRF52 */
+#define sys_le16_to_cpu(x) (x)
+#define sys_cpu_to_le16(x) (x)
+#define sys_le32_to_cpu(x) (x)
+#define sys_cpu_to_le32(x) (x)
+
+static inline void sys_put_le16(u16_t v, u8_t* d) {
+    d[0] = v;
+    d[1] = v >> 8;
+}
+
+static inline u16_t sys_get_le16(const u8_t* d) {
+    return d[0] | (d[1] << 8);
+}
+
+static inline void sys_put_le32(u32_t v, u8_t* d) {
+    sys_put_le16(v, d);
+    sys_put_le16(v >> 16, d + 2);
+}
+
+static inline u32_t sys_get_le32(const u8_t* d) {
+    return sys_get_le16(d) | ((u32_t)sys_get_le16(d + 2) << 16);
+}
+
+#endif
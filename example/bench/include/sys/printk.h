@@ -0,0 +1,7 @@
+#ifndef BENCH_SYS_PRINTK_H
+#define BENCH_SYS_PRINTK_H
+
+/* Discarded unless the benchmark runs with -v */
+void printk(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef BENCH_ZEPHYR_H
+#define BENCH_ZEPHYR_H
+
+/* Host shim of the kernel API the client uses.
+ *
+ * There are no threads. Everything runs from the event loop in sim.c, on a
+ * virtual clock, so mutexes have nothing to do and a work item runs when the
+ * event loop reaches the time it was submitted for.
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/printk.h>
+
+#define IS_ENABLED(config_macro) Z_IS_ENABLED1(config_macro)
+#define Z_IS_ENABLED1(config_macro) Z_IS_ENABLED2(_XXXX##config_macro)
+#define _XXXX1 _YYYY,
+#define Z_IS_ENABLED2(one_or_two_args) Z_IS_ENABLED3(one_or_two_args 1, 0)
+#define Z_IS_ENABLED3(ignore_this, val, ...) val
+
+#define ARG_UNUSED(x) (void)(x)
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define BIT(n) (1UL << (n))
+#define BIT_MASK(n) (BIT(n) - 1)
+#define CONTAINER_OF(ptr, type, field) \
+    ((type*)(((char*)(ptr)) - offsetof(type, field)))
+#define __aligned(x) __attribute__((aligned(x)))
+#define POINTER_TO_UINT(x) ((uintptr_t)(x))
+#define UINT_TO_POINTER(x) ((void*)(uintptr_t)(x))
+#define BUILD_ASSERT(expr, ...) _Static_assert(expr, #expr)
+
+/* Memory, accounted for by sim.c and limited to CONFIG_HEAP_MEM_POOL_SIZE */
+void* k_malloc(size_t size);
+void k_free(void* ptr);
+
+/* Time, in milliseconds like the kernel */
+typedef struct {
+    s64_t ms;
+} k_timeout_t;
+
+#define K_NO_WAIT  ((k_timeout_t){0})
+#define K_FOREVER  ((k_timeout_t){-1})
+#define K_MSEC(ms) ((k_timeout_t){(ms)})
+#define K_SECONDS(s) ((k_timeout_t){(s) * 1000})
+
+s64_t k_uptime_get(void);
+u32_t k_uptime_get_32(void);
+
+/* Runs the simulation for the given time. Only main() may sleep. */
+s32_t k_sleep(k_timeout_t timeout);
+
+struct k_mutex {
+    int unused;
+};
+
+#define K_MUTEX_DEFINE(name) struct k_mutex name
+
+static inline int k_mutex_lock(struct k_mutex* mutex, k_timeout_t timeout) {
+    return 0;
+}
+
+static inline int k_mutex_unlock(struct k_mutex* mutex) {
+    return 0;
+}
+
+/* A timed callback in the event loop of sim.c */
+struct sim_event {
+    s64_t at;  // virtual time in us
+    u32_t seq; // keeps events at the same time in submission order
+    bool armed;
+    void (*fn)(struct sim_event* ev);
+};
+
+struct k_work;
+typedef void (*k_work_handler_t)(struct k_work* work);
+
+struct k_work {
+    k_work_handler_t handler;
+    bool pending;
+};
+
+#define K_WORK_DEFINE(work, work_handler) \
+    struct k_work work = { .handler = work_handler }
+
+/* Only the server uses these, catchup.c runs them */
+void k_work_init(struct k_work* work, k_work_handler_t handler);
+void k_work_submit(struct k_work* work);
+
+struct k_delayed_work {
+    struct k_work work;
+    struct sim_event ev;
+};
+
+void k_delayed_work_init(struct k_delayed_work* work, k_work_handler_t handler);
+int k_delayed_work_submit(struct k_delayed_work* work, k_timeout_t delay);
+int k_delayed_work_cancel(struct k_delayed_work* work);
+s32_t k_delayed_work_remaining_get(struct k_delayed_work* work);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef BENCH_ZEPHYR_TYPES_H
+#define BENCH_ZEPHYR_TYPES_H
+
+/* Host shim of the Zephyr headers the client includes, see ../../README.md */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint8_t  u8_t;
+typedef uint16_t u16_t;
+typedef uint32_t u32_t;
+typedef uint64_t u64_t;
+typedef int8_t   s8_t;
+typedef int16_t  s16_t;
+typedef int32_t  s32_t;
+typedef int64_t  s64_t;
+
+#endif
@@ -0,0 +1,1217 @@
+#include "sim.h"
+#include "runtime.h"
+#include "wire.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include <zephyr.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/gatt.h>
+#include <settings/settings.h>
+#include <shell/shell.h>
+#include <random/rand32.h>
+
+/*********** Model ***********/
+/* The numbers follow the server and client configurations, and the Zephyr
+ * defaults where they do not say anything.
+ */
+#define ADV_INTERVAL_US    100000  // BT_GAP_ADV_FAST_INT_MIN_2, as the server
+#define ADV_DELAY_US       10000   // random advDelay added to every adv event
+#define CREATE_TIMEOUT_US  3000000 // CONFIG_BT_CREATE_CONN_TIMEOUT
+#define ENCRYPT_EVENTS     2       // start encryption with a stored LTK
+#define PAIR_EVENTS        6       // pairing, key distribution and encryption
+#define PDUS_PER_EVENT     4       // notifications a server sends per event
+#define TX_QUEUE           8       // notifications a server can buffer
+#define ATT_OPS            16      // outstanding client requests per link
+#define SUBSCRIPTIONS      8       // per link
+#define MAX_PAIRED         5       // CONFIG_BT_MAX_PAIRED of the client
+#define TEARDOWN_MS        5000
+#define PAYLOAD_MAX        20      // default ATT MTU of 23, no MTU exchange
+#define EATT_SETUP_EVENTS  1       // L2CAP credit based connection request
+#define HISTORY            64      // CONFIG_APP_HISTORY_SIZE of the server
+#define CATCH_UP_WINDOW    2       // runs the server has in flight at a time
+
+/* With CONFIG_BT_EATT the stack connects CONFIG_BT_EATT_MAX more bearers once
+ * the link is encrypted, and every bearer has a request of its own answered
+ * per connection event.
+ */
+#if defined(CONFIG_BT_EATT)
+#define EATT_BEARERS CONFIG_BT_EATT_MAX
+#else
+#define EATT_BEARERS 0
+#endif
+
+static struct sim_config config;
+static struct sim_results results;
+
+/*********** Event loop ***********/
+static s64_t now_us;
+static u32_t next_seq;
+static struct sim_event** events;
+static int n_events;
+static int max_events;
+static bool in_event;
+
+static void schedule(struct sim_event* ev, s64_t at) {
+    if(!ev->armed) {
+        if(n_events == max_events) {
+            fprintf(stderr, "sim: more than %d events\n", max_events);
+            abort();
+        }
+        events[n_events++] = ev;
+        ev->armed = true;
+    }
+    ev->at = at < now_us ? now_us : at;
+    ev->seq = next_seq++;
+}
+
+static void cancel(struct sim_event* ev) {
+    if(!ev->armed) {
+        return;
+    }
+    for(int i = 0; i < n_events; i++) {
+        if(events[i] == ev) {
+            events[i] = events[--n_events];
+            break;
+        }
+    }
+    ev->armed = false;
+}
+
+void sim_run(s64_t ms) {
+    s64_t until = now_us + ms * 1000;
+
+    for(;;) {
+        struct sim_event* first = NULL;
+        int index = 0;
+
+        for(int i = 0; i < n_events; i++) {
+            struct sim_event* ev = events[i];
+            if(!first || ev->at < first->at ||
+               (ev->at == first->at && ev->seq < first->seq)) {
+                first = ev;
+                index = i;
+            }
+        }
+        if(!first || first->at > until) {
+            break;
+        }
+
+        events[index] = events[--n_events];
+        first->armed = false;
+        now_us = first->at;
+        in_event = true;
+        first->fn(first);
+        in_event = false;
+    }
+    now_us = until;
+}
+
+static u32_t random_below(u32_t n) {
+    return n ? sys_rand32_get() % n : 0;
+}
+
+static bool heard(u16_t window, u16_t interval) {
+    return !interval || random_below(interval) < window;
+}
+
+static void sample_push(struct sim_samples* s, u32_t v) {
+    if(s->n == s->size) {
+        s->size = s->size ? s->size * 2 : 1024;
+        s->v = realloc(s->v, s->size * sizeof(*s->v));
+        if(!s->v) {
+            abort();
+        }
+    }
+    s->v[s->n++] = v;
+}
+
+/*********** Kernel ***********/
+static u32_t rand_state;
+
+u32_t sys_rand32_get(void) {
+    // xorshift32
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+void printk(const char* fmt, ...) {
+    va_list args;
+
+    if(!config.verbose) {
+        return;
+    }
+    fprintf(stderr, "[%8lld.%03lld] ", (long long)(now_us / 1000000),
+            (long long)(now_us / 1000 % 1000));
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+void shell_print(const struct shell* shell, const char* fmt, ...) {
+}
+
+s64_t k_uptime_get(void) {
+    return now_us / 1000;
+}
+
+u32_t k_uptime_get_32(void) {
+    return (u32_t)k_uptime_get();
+}
+
+/* Only main() may sleep, a callback that sleeps blocks the Bluetooth thread */
+
+s32_t k_sleep(k_timeout_t timeout) {
+    if(in_event) {
+        fprintf(stderr, "sim: k_sleep from a callback, the stack would stall\n");
+        abort();
+    }
+    sim_run(timeout.ms);
+    return 0;
+}
+
+/* Every block carries its size, so k_free knows what it gives back */
+struct heap_block {
+    size_t size;
+    u64_t data[];
+};
+
+/* Zephyr's k_malloc puts the id of the block in front of it, and the heap
+ * hands out 8 byte chunks behind a chunk header. That is what a block takes
+ * from CONFIG_HEAP_MEM_POOL_SIZE, and what the heap figures count.
+ */
+#define HEAP_CHUNK  8
+#define HEAP_HEADER 8
+
+void* k_malloc(size_t request) {
+    struct heap_block* block;
+    size_t size = (request + HEAP_HEADER + HEAP_CHUNK - 1) / HEAP_CHUNK * HEAP_CHUNK;
+
+    if(config.heap_limit && results.heap_live + size > (size_t)config.heap_limit) {
+        results.heap_failures++;
+        printk("k_malloc(%zu) failed, %u of %d bytes in use\n",
+               request, results.heap_live, config.heap_limit);
+        return NULL;
+    }
+    block = malloc(sizeof(*block) + request);
+    if(!block) {
+        abort();
+    }
+    block->size = size;
+    results.heap_live += size;
+    results.heap_allocs++;
+    results.heap_peak = MAX(results.heap_peak, results.heap_live);
+    return block->data;
+}
+
+void k_free(void* ptr) {
+    struct heap_block* block;
+
+    if(!ptr) {
+        return;
+    }
+    block = CONTAINER_OF(ptr, struct heap_block, data);
+    results.heap_live -= block->size;
+    free(block);
+}
+
+void sim_mark_heap_baseline(void) {
+    results.heap_baseline = results.heap_live;
+}
+
+static void run_work(struct sim_event* ev) {
+    struct k_delayed_work* work = CONTAINER_OF(ev, struct k_delayed_work, ev);
+    work->work.handler(&work->work);
+}
+
+void k_delayed_work_init(struct k_delayed_work* work, k_work_handler_t handler) {
+    memset(work, 0, sizeof(*work));
+    work->work.handler = handler;
+    work->ev.fn = run_work;
+}
+
+int k_delayed_work_submit(struct k_delayed_work* work, k_timeout_t delay) {
+    schedule(&work->ev, now_us + delay.ms * 1000);
+    return 0;
+}
+
+int k_delayed_work_cancel(struct k_delayed_work* work) {
+    cancel(&work->ev);
+    return 0;
+}
+
+s32_t k_delayed_work_remaining_get(struct k_delayed_work* work) {
+    return work->ev.armed ? (work->ev.at - now_us) / 1000 : 0;
+}
+
+int settings_load(void) {
+    return 0;
+}
+
+/*********** Servers ***********/
+/* Every simulated server has the attribute table of example/server:
+ *
+ *   1 service 0xff11, 2 characteristic 0xff12, 3 value, 4 CCC
+ *   5 service 0xff21, 6 characteristic 0xff22, 7 value, 8 CCC
+ *
+ * and notifies the two values in turn, as wire_samples padded to the
+ * configured payload size. Like the server it keeps the last HISTORY samples
+ * of each value, and answers a History.Since written to a value with runs of
+ * the samples after it, up to another HISTORY samples past the newest one at
+ * the time. As the server has CATCH_UP_WINDOW runs in the stack's queue at a
+ * time, that many go first in every connection event, then the queued
+ * notifications, then more runs if there is room left.
+ */
+#define TEMPERATURE_HANDLE 3
+#define OCTAVIUS_HANDLE    7
+
+static struct bt_uuid_16 uuid_primary = BT_UUID_INIT_16(0x2800);
+static struct bt_uuid_16 uuid_chrc = BT_UUID_INIT_16(0x2803);
+static struct bt_uuid_16 uuid_ccc = BT_UUID_INIT_16(0x2902);
+static struct bt_uuid_16 uuid_temperature_svc = BT_UUID_INIT_16(0xff11);
+static struct bt_uuid_16 uuid_temperature = BT_UUID_INIT_16(0xff12);
+static struct bt_uuid_16 uuid_octavius_svc = BT_UUID_INIT_16(0xff21);
+static struct bt_uuid_16 uuid_octavius = BT_UUID_INIT_16(0xff22);
+
+static struct bt_gatt_service_val temperature_svc = { &uuid_temperature_svc.uuid, 4 };
+static struct bt_gatt_chrc temperature_chrc = { &uuid_temperature.uuid, 3,
+                                                BT_GATT_CHRC_NOTIFY | BT_GATT_CHRC_WRITE };
+static struct bt_gatt_service_val octavius_svc = { &uuid_octavius_svc.uuid, 8 };
+static struct bt_gatt_chrc octavius_chrc = { &uuid_octavius.uuid, 7,
+                                             BT_GATT_CHRC_NOTIFY | BT_GATT_CHRC_WRITE };
+
+static const struct bt_gatt_attr server_attrs[] = {
+    { .uuid = &uuid_primary.uuid, .user_data = &temperature_svc, .handle = 1 },
+    { .uuid = &uuid_chrc.uuid, .user_data = &temperature_chrc, .handle = 2 },
+    { .uuid = &uuid_temperature.uuid, .handle = 3 },
+    { .uuid = &uuid_ccc.uuid, .handle = 4 },
+    { .uuid = &uuid_primary.uuid, .user_data = &octavius_svc, .handle = 5 },
+    { .uuid = &uuid_chrc.uuid, .user_data = &octavius_chrc, .handle = 6 },
+    { .uuid = &uuid_octavius.uuid, .handle = 7 },
+    { .uuid = &uuid_ccc.uuid, .handle = 8 },
+};
+
+static const u8_t server_ad[] = {
+    2, BT_DATA_FLAGS, BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR,
+    7, BT_DATA_UUID16_ALL, 0xcc, 0xff, 0xaa, 0xff, 0x0a, 0x18,
+};
+
+struct notification {
+    u16_t handle;
+    u8_t len;
+    u8_t data[PAYLOAD_MAX];
+    s64_t produced;
+    bool run;        // a History.Run of a catch-up
+};
+
+struct server {
+    bt_addr_le_t addr;
+    bool advertising;
+    struct bt_conn* conn;
+    bool notify[2];  // CCC of temperature and octavius
+    u32_t samples;
+    u32_t seqs[2];                // of the newest temperature and octavius
+    s64_t produced[2][HISTORY];   // of sample seq, at seq % HISTORY
+    u32_t catch_up[2];            // next seq to send, 0 when there is none
+    u32_t until[2];               // last seq the catch-up sends at most
+    struct notification queue[TX_QUEUE];
+    int head;
+    int queued;
+    struct sim_event adv;
+    struct sim_event sample;
+    struct sim_event churn;
+};
+
+static struct server* servers;
+static bool tearing_down;
+
+static void disconnect_link(struct bt_conn* conn, u8_t reason);
+
+static void start_advertising(struct server* s) {
+    s->advertising = !tearing_down;
+    if(s->advertising) {
+        schedule(&s->adv, now_us + random_below(ADV_INTERVAL_US));
+    }
+}
+
+static int ccc_index(u16_t handle) {
+    return handle == TEMPERATURE_HANDLE || handle == TEMPERATURE_HANDLE + 1 ? 0 : 1;
+}
+
+/* The values change, so the program has work to do */
+static void sample_of(int i, u32_t seq, struct wire_sample* sample) {
+    if(!i) {
+        sample->tag = WIRE_SAMPLE_TEMPERATURE;
+        sample->temperature.value = 15 + (seq - 1) % 20;
+        sample->temperature.seq = seq;
+    } else {
+        sample->tag = WIRE_SAMPLE_OCTAVIUS;
+        sample->octavius.open = (seq - 1) % 2;
+        sample->octavius.seq = seq;
+    }
+}
+
+/* Packs the next samples of a catch-up into a run, as the server does */
+static void next_run(struct server* s, int i, struct notification* n) {
+    struct wire_history run = { .tag = WIRE_HISTORY_RUN };
+    u8_t samples[PAYLOAD_MAX];
+    u32_t newest = MIN(s->seqs[i], s->until[i]);
+    u32_t* next = &s->catch_up[i];
+
+    run.run.newest = newest;
+    run.run.samples.data = samples;
+    *next = MAX(*next, newest >= HISTORY ? newest - HISTORY + 1 : 1);
+    n->handle = i ? OCTAVIUS_HANDLE : TEMPERATURE_HANDLE;
+    n->produced = now_us;
+    n->run = true;
+
+    while(*next <= newest) {
+        struct wire_history attempt = run;
+        struct wire_sample sample;
+        int len;
+
+        sample_of(i, *next, &sample);
+        len = wire_encode_sample(&sample, &samples[run.run.samples.len],
+                                 PAYLOAD_MAX - run.run.samples.len);
+        if(len < 0) {
+            break;
+        }
+        if(!run.run.samples.len) {
+            attempt.run.age = (now_us - s->produced[i][*next % HISTORY]) / 1000;
+        }
+        attempt.run.samples.len += len;
+        len = wire_encode_history(&attempt, n->data, PAYLOAD_MAX);
+        if(len < 0) {
+            break;
+        }
+        run = attempt;
+        (*next)++;
+    }
+    // a failed attempt may have left the data half written
+    n->len = wire_encode_history(&run, n->data, PAYLOAD_MAX);
+
+    if(*next > newest) {
+        *next = 0;
+    }
+}
+
+static void produce(struct sim_event* ev) {
+    struct server* s = CONTAINER_OF(ev, struct server, sample);
+    struct wire_sample sample;
+    struct notification* n;
+    u8_t buf[PAYLOAD_MAX] = {0};
+    int len;
+
+    if(tearing_down) {
+        return;
+    }
+    schedule(ev, now_us + 1000000 / config.rate_hz);
+
+    int i = s->samples++ % 2;
+    u32_t seq = ++s->seqs[i];
+
+    sample_of(i, seq, &sample);
+    s->produced[i][seq % HISTORY] = now_us;
+    results.offered++;
+
+    len = wire_encode_sample(&sample, buf, sizeof(buf));
+    len = MAX(len, config.payload);
+
+    if(!s->conn) {
+        results.lost_unconnected++;
+        return;
+    }
+    if(!s->notify[sample.tag == WIRE_SAMPLE_OCTAVIUS]) {
+        results.lost_unsubscribed++;
+        return;
+    }
+    if(s->queued == TX_QUEUE) {
+        results.dropped_queue++;
+        return;
+    }
+
+    n = &s->queue[(s->head + s->queued++) % TX_QUEUE];
+    n->handle = sample.tag == WIRE_SAMPLE_OCTAVIUS ? OCTAVIUS_HANDLE : TEMPERATURE_HANDLE;
+    n->len = len;
+    memcpy(n->data, buf, len);
+    n->produced = now_us;
+    n->run = false;
+}
+
+static void churn(struct sim_event* ev) {
+    struct server* s = CONTAINER_OF(ev, struct server, churn);
+
+    if(s->conn) {
+        disconnect_link(s->conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+    }
+}
+
+/*********** Links ***********/
+enum link_state {
+    LINK_IDLE,
+    LINK_INITIATING,
+    LINK_CONNECTED,
+};
+
+enum att_op {
+    ATT_DISCOVER,
+    ATT_SUBSCRIBE,
+    ATT_UNSUBSCRIBE,
+    ATT_WRITE,
+};
+
+struct att_request {
+    enum att_op op;
+    void* params;
+};
+
+struct bt_conn {
+    int refs;
+    enum link_state state;
+    bt_addr_le_t dst;
+    struct server* server;
+    u16_t interval;   // units of 1.25 ms
+    u16_t create_interval;
+    u16_t create_window;
+    bt_security_t security;
+    bool ready;
+    s64_t connected_at;
+    s64_t eatt_from;  // when the enhanced bearers are up, -1 before encryption
+    u32_t skipped;    // connection events lost in a row to scan windows
+
+    struct att_request requests[ATT_OPS];
+    int n_requests;
+    struct bt_gatt_subscribe_params* subscriptions[SUBSCRIPTIONS];
+
+    struct sim_event event;   // connection events
+    struct sim_event timeout; // of the connection attempt
+    struct sim_event encrypted;
+};
+
+static struct bt_conn conns[CONFIG_BT_MAX_CONN];
+static struct bt_conn* initiating;
+static struct bt_conn_cb* callbacks;
+static bt_addr_le_t bonds[MAX_PAIRED];
+static int n_bonds;
+
+#define FOREACH_CB(cb) for(struct bt_conn_cb* cb = callbacks; cb; cb = cb->_next)
+
+struct bt_conn* bt_conn_ref(struct bt_conn* conn) {
+    conn->refs++;
+    return conn;
+}
+
+void bt_conn_unref(struct bt_conn* conn) {
+    if(conn->refs <= 0) {
+        fprintf(stderr, "sim: bt_conn_unref on a released link\n");
+        abort();
+    }
+    conn->refs--;
+}
+
+u8_t bt_conn_index(struct bt_conn* conn) {
+    return conn - conns;
+}
+
+const bt_addr_le_t* bt_conn_get_dst(const struct bt_conn* conn) {
+    return &conn->dst;
+}
+
+int bt_conn_get_info(const struct bt_conn* conn, struct bt_conn_info* info) {
+    memset(info, 0, sizeof(*info));
+    info->role = BT_CONN_ROLE_MASTER;
+    info->le.dst = &conn->dst;
+    info->le.interval = conn->interval;
+    return 0;
+}
+
+struct bt_conn* bt_conn_lookup_addr_le(u8_t id, const bt_addr_le_t* peer) {
+    for(int i = 0; i < CONFIG_BT_MAX_CONN; i++) {
+        if(conns[i].state != LINK_IDLE && !bt_addr_le_cmp(&conns[i].dst, peer)) {
+            return bt_conn_ref(&conns[i]);
+        }
+    }
+    return NULL;
+}
+
+void bt_conn_cb_register(struct bt_conn_cb* cb) {
+    cb->_next = callbacks;
+    callbacks = cb;
+}
+
+static struct server* server_of(const bt_addr_le_t* addr) {
+    for(int i = 0; i < config.peripherals; i++) {
+        if(!bt_addr_le_cmp(&servers[i].addr, addr)) {
+            return &servers[i];
+        }
+    }
+    return NULL;
+}
+
+static void release_link(struct bt_conn* conn) {
+    conn->state = LINK_IDLE;
+    cancel(&conn->event);
+    cancel(&conn->timeout);
+    cancel(&conn->encrypted);
+    bt_conn_unref(conn); // the reference of the stack
+}
+
+static void connection_event(struct sim_event* ev);
+
+static void establish(struct bt_conn* conn) {
+    struct server* s = conn->server;
+
+    initiating = NULL;
+    cancel(&conn->timeout);
+    s->advertising = false;
+    cancel(&s->adv);
+    s->conn = conn;
+    s->notify[0] = s->notify[1] = false;
+    s->catch_up[0] = s->catch_up[1] = 0;
+
+    conn->state = LINK_CONNECTED;
+    conn->connected_at = now_us;
+    conn->ready = false;
+    conn->security = BT_SECURITY_L1;
+    conn->eatt_from = -1;
+    conn->skipped = 0;
+    conn->n_requests = 0;
+    memset(conn->subscriptions, 0, sizeof(conn->subscriptions));
+    schedule(&conn->event, now_us + conn->interval * 1250);
+    if(config.churn_ms) {
+        // uniform around the mean, so the links do not drop in lockstep
+        schedule(&s->churn, now_us + (config.churn_ms / 2 + random_below(config.churn_ms)) * 1000LL);
+    }
+
+    if(!tearing_down) {
+        results.connects++;
+    }
+    FOREACH_CB(cb) {
+        if(cb->connected) {
+            cb->connected(conn, 0);
+        }
+    }
+}
+
+static void create_timeout(struct sim_event* ev) {
+    struct bt_conn* conn = CONTAINER_OF(ev, struct bt_conn, timeout);
+
+    initiating = NULL;
+    if(!tearing_down) {
+        results.connect_failures++;
+    }
+    conn->state = LINK_IDLE;
+    FOREACH_CB(cb) {
+        if(cb->connected) {
+            cb->connected(conn, BT_HCI_ERR_UNKNOWN_CONN_ID);
+        }
+    }
+    bt_conn_unref(conn);
+}
+
+int bt_conn_le_create(const bt_addr_le_t* peer,
+                      const struct bt_conn_le_create_param* create_param,
+                      const struct bt_le_conn_param* conn_param,
+                      struct bt_conn** ret) {
+    struct bt_conn* conn = NULL;
+    struct server* s = server_of(peer);
+
+    if(initiating) {
+        return -EALREADY;
+    }
+    for(int i = 0; i < CONFIG_BT_MAX_CONN; i++) {
+        if(conns[i].state != LINK_IDLE && !bt_addr_le_cmp(&conns[i].dst, peer)) {
+            return -EINVAL;
+        }
+        if(!conn && !conns[i].refs) {
+            conn = &conns[i];
+        }
+    }
+    if(!conn) {
+        return -ENOMEM;
+    }
+    if(!s) {
+        return -EINVAL;
+    }
+
+    conn->refs = 2; // the caller and the stack
+    conn->state = LINK_INITIATING;
+    conn->server = s;
+    bt_addr_le_copy(&conn->dst, peer);
+    conn->interval = conn_param->interval_min;
+    conn->create_interval = create_param->interval;
+    conn->create_window = create_param->window;
+    schedule(&conn->timeout, now_us + (create_param->timeout ?
+                                       create_param->timeout * 10000LL :
+                                       CREATE_TIMEOUT_US));
+    initiating = conn;
+    *ret = conn;
+    return 0;
+}
+
+static void disconnect_link(struct bt_conn* conn, u8_t reason) {
+    struct server* s = conn->server;
+    struct att_request requests[ATT_OPS];
+    int n_requests = conn->n_requests;
+
+    if(!tearing_down) {
+        results.disconnects++;
+        results.dropped_link += s->queued;
+    }
+    s->queued = 0;
+    s->conn = NULL;
+    cancel(&s->churn);
+    conn->state = LINK_IDLE;
+    cancel(&conn->event);
+
+    // outstanding requests fail, which ends a discovery with attr == NULL
+    memcpy(requests, conn->requests, sizeof(requests));
+    conn->n_requests = 0;
+    for(int i = 0; i < n_requests; i++) {
+        if(requests[i].op == ATT_DISCOVER) {
+            struct bt_gatt_discover_params* params = requests[i].params;
+            params->func(conn, NULL, params);
+        } else if(requests[i].op == ATT_WRITE) {
+            struct bt_gatt_write_params* params = requests[i].params;
+            params->func(conn, BT_ATT_ERR_UNLIKELY, params);
+        }
+    }
+
+    // the stack drops the subscriptions and tells their owners
+    for(int i = 0; i < SUBSCRIPTIONS; i++) {
+        struct bt_gatt_subscribe_params* params = conn->subscriptions[i];
+        if(params) {
+            conn->subscriptions[i] = NULL;
+            params->notify(conn, params, NULL, 0);
+        }
+    }
+
+    FOREACH_CB(cb) {
+        if(cb->disconnected) {
+            cb->disconnected(conn, reason);
+        }
+    }
+    release_link(conn);
+    start_advertising(s);
+}
+
+int bt_conn_disconnect(struct bt_conn* conn, u8_t reason) {
+    if(conn->state != LINK_CONNECTED) {
+        return -ENOTCONN;
+    }
+    disconnect_link(conn, BT_HCI_ERR_LOCALHOST_TERM_CONN);
+    return 0;
+}
+
+/*********** Security ***********/
+static bool bonded(const bt_addr_le_t* addr) {
+    for(int i = 0; i < n_bonds; i++) {
+        if(!bt_addr_le_cmp(&bonds[i], addr)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void encrypted(struct sim_event* ev) {
+    struct bt_conn* conn = CONTAINER_OF(ev, struct bt_conn, encrypted);
+
+    if(!bonded(&conn->dst) && n_bonds < MAX_PAIRED) {
+        bt_addr_le_copy(&bonds[n_bonds++], &conn->dst);
+    }
+    conn->security = BT_SECURITY_L2;
+    conn->eatt_from = now_us + EATT_SETUP_EVENTS * conn->interval * 1250LL;
+    FOREACH_CB(cb) {
+        if(cb->security_changed) {
+            cb->security_changed(conn, conn->security, BT_SECURITY_ERR_SUCCESS);
+        }
+    }
+}
+
+int bt_conn_set_security(struct bt_conn* conn, bt_security_t sec) {
+    int events = bonded(&conn->dst) ? ENCRYPT_EVENTS : PAIR_EVENTS;
+
+    if(conn->state != LINK_CONNECTED) {
+        return -ENOTCONN;
+    }
+    if(conn->security >= sec || conn->encrypted.armed) {
+        return 0;
+    }
+    schedule(&conn->encrypted, now_us + events * conn->interval * 1250LL);
+    return 0;
+}
+
+void bt_foreach_bond(u8_t id, void (*func)(const struct bt_bond_info* info, void* user_data),
+                     void* user_data) {
+    for(int i = 0; i < n_bonds; i++) {
+        struct bt_bond_info info;
+
+        bt_addr_le_copy(&info.addr, &bonds[i]);
+        func(&info, user_data);
+    }
+}
+
+int bt_unpair(u8_t id, const bt_addr_le_t* addr) {
+    for(int i = 0; i < n_bonds; i++) {
+        if(!bt_addr_le_cmp(&bonds[i], addr)) {
+            bonds[i] = bonds[--n_bonds];
+            break;
+        }
+    }
+    return 0;
+}
+
+/*********** Scanning ***********/
+static bool scanning;
+static struct bt_le_scan_param scan_param;
+static bt_le_scan_cb_t* scan_cb;
+static s64_t scan_since;
+static s64_t scan_phase;  // when the first window opens
+
+/* Adds the radio time of the scan windows since the last call */
+static void account_scan(void) {
+    if(scanning && !tearing_down) {
+        results.scan_us += (now_us - scan_since) * scan_param.window / scan_param.interval;
+    }
+    scan_since = now_us;
+}
+
+/* The controller opens a scan window every scan interval, from a moment of
+ * its choosing after the scan starts that has nothing to do with the anchors
+ * of the links, so the sim draws it. A connection event that falls due while
+ * a window is open loses the radio to the scanner. An event keeps the radio
+ * if it is already running when a window opens.
+ *
+ * With a scan interval that is a multiple of a connection interval, the
+ * phase between the two would be fixed, and the windows would take either
+ * every event of a link at that phase or none of them. skip_run_max shows
+ * whether a link loses events in a row.
+ */
+static bool in_scan_window(s64_t at) {
+    s64_t interval_us = scan_param.interval * 625LL;
+
+    return at >= scan_phase &&
+           (at - scan_phase) % interval_us < scan_param.window * 625LL;
+}
+
+int bt_enable(bt_ready_cb_t cb) {
+    if(cb) {
+        cb(0);
+    }
+    return 0;
+}
+
+int bt_le_scan_start(const struct bt_le_scan_param* param, bt_le_scan_cb_t cb) {
+    if(scanning) {
+        return -EALREADY;
+    }
+    scanning = true;
+    scan_param = *param;
+    scan_cb = cb;
+    scan_since = now_us;
+    scan_phase = now_us + random_below(scan_param.interval) * 625LL;
+    return 0;
+}
+
+int bt_le_scan_stop(void) {
+    if(!scanning) {
+        return -EALREADY;
+    }
+    account_scan();
+    scanning = false;
+    return 0;
+}
+
+/* One advertising event of a server: the scanner may hear it, and an
+ * initiator waiting for this server connects on it
+ */
+static void advertise(struct sim_event* ev) {
+    struct server* s = CONTAINER_OF(ev, struct server, adv);
+
+    if(!s->advertising) {
+        return;
+    }
+    schedule(ev, now_us + ADV_INTERVAL_US + random_below(ADV_DELAY_US));
+
+    if(initiating && initiating->server == s &&
+       heard(initiating->create_window, initiating->create_interval)) {
+        establish(initiating);
+        return;
+    }
+
+    if(scanning && heard(scan_param.window, scan_param.interval)) {
+        u8_t data[sizeof(server_ad)];
+        struct net_buf_simple ad = { data, sizeof(data), sizeof(data), data };
+
+        memcpy(data, server_ad, sizeof(data));
+        scan_cb(&s->addr, -50, BT_GAP_ADV_TYPE_ADV_IND, &ad);
+    }
+}
+
+int bt_addr_le_to_str(const bt_addr_le_t* addr, char* str, size_t len) {
+    return snprintf(str, len, "%02X:%02X:%02X:%02X:%02X:%02X (%s)",
+                    addr->a.val[5], addr->a.val[4], addr->a.val[3],
+                    addr->a.val[2], addr->a.val[1], addr->a.val[0],
+                    addr->type == BT_ADDR_LE_RANDOM ? "random" : "public");
+}
+
+void net_buf_simple_save(struct net_buf_simple* buf, struct net_buf_simple_state* state) {
+    state->offset = buf->data - buf->__buf;
+    state->len = buf->len;
+}
+
+void net_buf_simple_restore(struct net_buf_simple* buf, struct net_buf_simple_state* state) {
+    buf->data = buf->__buf + state->offset;
+    buf->len = state->len;
+}
+
+void bt_data_parse(struct net_buf_simple* ad,
+                   bool (*func)(struct bt_data* data, void* user_data),
+                   void* user_data) {
+    while(ad->len > 1) {
+        struct bt_data data;
+        u8_t len = ad->data[0];
+
+        if(!len || len > ad->len - 1) {
+            return;
+        }
+        data.type = ad->data[1];
+        data.data_len = len - 1;
+        data.data = &ad->data[2];
+        ad->data += len + 1;
+        ad->len -= len + 1;
+
+        if(!func(&data, user_data)) {
+            return;
+        }
+    }
+}
+
+/*********** GATT client ***********/
+int bt_uuid_cmp(const struct bt_uuid* u1, const struct bt_uuid* u2) {
+    return (int)BT_UUID_16(u1)->val - (int)BT_UUID_16(u2)->val;
+}
+
+u16_t bt_gatt_attr_value_handle(const struct bt_gatt_attr* attr) {
+    return ((struct bt_gatt_chrc*)attr->user_data)->value_handle;
+}
+
+ssize_t bt_gatt_attr_read(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                          void* buf, u16_t buf_len, u16_t offset,
+                          const void* value, u16_t value_len) {
+    if(offset > value_len) {
+        return -EINVAL;
+    }
+    value_len = MIN(buf_len, value_len - offset);
+    memcpy(buf, (const u8_t*)value + offset, value_len);
+    return value_len;
+}
+
+ssize_t bt_gatt_attr_read_service(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                  void* buf, u16_t len, u16_t offset) {
+    return 0;
+}
+
+ssize_t bt_gatt_attr_read_chrc(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                               void* buf, u16_t len, u16_t offset) {
+    return 0;
+}
+
+static int request(struct bt_conn* conn, enum att_op op, void* params) {
+    if(conn->state != LINK_CONNECTED) {
+        return -ENOTCONN;
+    }
+    if(conn->n_requests == ATT_OPS) {
+        return -ENOMEM;
+    }
+    conn->requests[conn->n_requests].op = op;
+    conn->requests[conn->n_requests].params = params;
+    conn->n_requests++;
+    return 0;
+}
+
+int bt_gatt_discover(struct bt_conn* conn, struct bt_gatt_discover_params* params) {
+    return request(conn, ATT_DISCOVER, params);
+}
+
+static bool discover_match(const struct bt_gatt_attr* attr,
+                           const struct bt_gatt_discover_params* params) {
+    const struct bt_uuid* uuid;
+
+    switch(params->type) {
+    case BT_GATT_DISCOVER_PRIMARY:
+        if(bt_uuid_cmp(attr->uuid, &uuid_primary.uuid)) {
+            return false;
+        }
+        uuid = ((struct bt_gatt_service_val*)attr->user_data)->uuid;
+        break;
+    case BT_GATT_DISCOVER_CHARACTERISTIC:
+        if(bt_uuid_cmp(attr->uuid, &uuid_chrc.uuid)) {
+            return false;
+        }
+        uuid = ((struct bt_gatt_chrc*)attr->user_data)->uuid;
+        break;
+    case BT_GATT_DISCOVER_DESCRIPTOR:
+        uuid = attr->uuid;
+        break;
+    default:
+        return false;
+    }
+    return !params->uuid || !bt_uuid_cmp(uuid, params->uuid);
+}
+
+/* The whole procedure is answered in one request, a server this small fits
+ * in one response
+ */
+static void discover(struct bt_conn* conn, struct bt_gatt_discover_params* params) {
+    for(int i = 0; i < ARRAY_SIZE(server_attrs); i++) {
+        const struct bt_gatt_attr* attr = &server_attrs[i];
+
+        if(attr->handle < params->start_handle || attr->handle > params->end_handle ||
+           !discover_match(attr, params)) {
+            continue;
+        }
+        if(params->func(conn, attr, params) == BT_GATT_ITER_STOP) {
+            return;
+        }
+    }
+    params->func(conn, NULL, params);
+}
+
+int bt_gatt_subscribe(struct bt_conn* conn, struct bt_gatt_subscribe_params* params) {
+    int free = -1;
+
+    if(conn->state != LINK_CONNECTED) {
+        return -ENOTCONN;
+    }
+    for(int i = 0; i < SUBSCRIPTIONS; i++) {
+        if(conn->subscriptions[i] == params) {
+            return -EALREADY;
+        }
+        if(free == -1 && !conn->subscriptions[i]) {
+            free = i;
+        }
+    }
+    if(free == -1) {
+        return -ENOMEM;
+    }
+
+    int err = request(conn, ATT_SUBSCRIBE, params);
+    if(!err) {
+        conn->subscriptions[free] = params;
+    }
+    return err;
+}
+
+int bt_gatt_write(struct bt_conn* conn, struct bt_gatt_write_params* params) {
+    return request(conn, ATT_WRITE, params);
+}
+
+/* Only History.Since can be written, to a sample value */
+static void write(struct bt_conn* conn, struct bt_gatt_write_params* params) {
+    struct server* s = conn->server;
+    struct wire_history h;
+    u8_t err = 0;
+
+    if(params->handle != TEMPERATURE_HANDLE && params->handle != OCTAVIUS_HANDLE) {
+        err = BT_ATT_ERR_WRITE_NOT_PERMITTED;
+    } else if(wire_decode_history(params->data, params->length, &h) < 0 ||
+              h.tag != WIRE_HISTORY_SINCE) {
+        err = BT_ATT_ERR_VALUE_NOT_ALLOWED;
+    } else {
+        int i = params->handle == OCTAVIUS_HANDLE;
+
+        s->catch_up[i] = h.since.seq + 1;
+        s->until[i] = s->seqs[i] + HISTORY;
+    }
+    params->func(conn, err, params);
+}
+
+int bt_gatt_unsubscribe(struct bt_conn* conn, struct bt_gatt_subscribe_params* params) {
+    for(int i = 0; i < SUBSCRIPTIONS; i++) {
+        if(conn->subscriptions[i] == params) {
+            conn->subscriptions[i] = NULL;
+            return request(conn, ATT_UNSUBSCRIBE, params);
+        }
+    }
+    return -EINVAL;
+}
+
+/* A notification the server sent reaches the program if the client finds
+ * its way to runtime_step with it
+ */
+static void deliver(struct bt_conn* conn, struct notification* n) {
+    struct bt_gatt_subscribe_params* subscribed[SUBSCRIPTIONS];
+    struct runtime_stats before, after;
+    struct timespec start, end;
+
+    // the callbacks may change the subscriptions
+    memcpy(subscribed, conn->subscriptions, sizeof(subscribed));
+
+    runtime_get_stats(&before);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i = 0; i < SUBSCRIPTIONS; i++) {
+        if(subscribed[i] && subscribed[i]->value_handle == n->handle) {
+            subscribed[i]->notify(conn, subscribed[i], n->data, n->len);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    runtime_get_stats(&after);
+
+    if(n->run) {
+        results.recovered += after.steps - before.steps;
+        return;
+    }
+    if(after.steps == before.steps) {
+        results.dropped_stack++;
+        return;
+    }
+    results.delivered++;
+    sample_push(&results.latency_us, now_us - n->produced);
+    sample_push(&results.dispatch_ns, (end.tv_sec - start.tv_sec) * 1000000000LL +
+                                      (end.tv_nsec - start.tv_nsec));
+    if(!conn->ready) {
+        conn->ready = true;
+        sample_push(&results.ready_ms, (now_us - conn->connected_at) / 1000);
+    }
+}
+
+static int bearers(struct bt_conn* conn) {
+    return 1 + (conn->eatt_from >= 0 && now_us >= conn->eatt_from ? EATT_BEARERS : 0);
+}
+
+/* One request of the client is answered per bearer and connection event,
+ * then the server sends what it has queued
+ */
+/* Sends up to max runs of the catch-ups, once their CCC is written. Returns
+ * how many it sent.
+ */
+static int send_runs(struct bt_conn* conn, int max) {
+    struct server* s = conn->server;
+    int pdus = 0;
+
+    for(int i = 0; i < 2; i++) {
+        for(; pdus < max && s->catch_up[i] && s->notify[i] && s->conn == conn; pdus++) {
+            struct notification n;
+
+            next_run(s, i, &n);
+            deliver(conn, &n);
+        }
+    }
+    return pdus;
+}
+
+static void connection_event(struct sim_event* ev) {
+    struct bt_conn* conn = CONTAINER_OF(ev, struct bt_conn, event);
+    struct server* s = conn->server;
+
+    schedule(ev, now_us + conn->interval * 1250);
+
+    if(scanning && in_scan_window(now_us)) {
+        if(!tearing_down) {
+            results.events_skipped++;
+            conn->skipped++;
+            results.skip_run_max = MAX(results.skip_run_max, conn->skipped);
+        }
+        return;
+    }
+    conn->skipped = 0;
+
+    for(int answered = bearers(conn); answered > 0 && conn->n_requests &&
+                                      conn->state == LINK_CONNECTED; answered--) {
+        struct att_request r = conn->requests[0];
+
+        conn->n_requests--;
+        memmove(&conn->requests[0], &conn->requests[1],
+                conn->n_requests * sizeof(conn->requests[0]));
+        switch(r.op) {
+        case ATT_DISCOVER:
+            discover(conn, r.params);
+            break;
+        case ATT_SUBSCRIBE:
+        case ATT_UNSUBSCRIBE: {
+            struct bt_gatt_subscribe_params* params = r.params;
+            s->notify[ccc_index(params->ccc_handle)] = r.op == ATT_SUBSCRIBE;
+            break;
+        }
+        case ATT_WRITE:
+            write(conn, r.params);
+            break;
+        }
+    }
+
+    int pdus = 0;
+
+    pdus += send_runs(conn, CATCH_UP_WINDOW);
+    for(; pdus < PDUS_PER_EVENT && s->queued && s->conn == conn; pdus++) {
+        struct notification n = s->queue[s->head];
+
+        s->head = (s->head + 1) % TX_QUEUE;
+        s->queued--;
+        deliver(conn, &n);
+    }
+
+    send_runs(conn, PDUS_PER_EVENT - pdus);
+}
+
+/*********** Setup ***********/
+void sim_init(const struct sim_config* c) {
+    config = *c;
+    rand_state = config.seed ? config.seed : 1;
+
+    servers = calloc(config.peripherals, sizeof(*servers));
+    max_events = config.peripherals * 3 + CONFIG_BT_MAX_CONN * 3 + 16;
+    events = calloc(max_events, sizeof(*events));
+    if(!servers || !events) {
+        abort();
+    }
+
+    for(int i = 0; i < CONFIG_BT_MAX_CONN; i++) {
+        conns[i].event.fn = connection_event;
+        conns[i].timeout.fn = create_timeout;
+        conns[i].encrypted.fn = encrypted;
+    }
+
+    for(int i = 0; i < config.peripherals; i++) {
+        struct server* s = &servers[i];
+
+        // random static addresses
+        s->addr.type = BT_ADDR_LE_RANDOM;
+        s->addr.a.val[0] = i;
+        s->addr.a.val[1] = i >> 8;
+        s->addr.a.val[5] = 0xc0;
+        s->adv.fn = advertise;
+        s->sample.fn = produce;
+        s->churn.fn = churn;
+        start_advertising(s);
+        schedule(&s->sample, random_below(1000000 / config.rate_hz));
+    }
+}
+
+void sim_teardown(void) {
+    account_scan();
+    tearing_down = true;
+    for(int i = 0; i < config.peripherals; i++) {
+        servers[i].advertising = false;
+        if(servers[i].conn) {
+            disconnect_link(servers[i].conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+        }
+    }
+    sim_run(TEARDOWN_MS);
+
+    for(int i = 0; i < CONFIG_BT_MAX_CONN; i++) {
+        if(conns[i].state == LINK_IDLE) {
+            results.conn_refs_leaked += conns[i].refs;
+        }
+    }
+}
+
+const struct sim_results* sim_results(void) {
+    return &results;
+}
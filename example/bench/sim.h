@@ -0,0 +1,82 @@
+#ifndef SIM_BLE
+#define SIM_BLE
+
+#include <zephyr/types.h>
+
+/* Simulated controller and sensor servers.
+ *
+ * The client's bt.c and main.c run unmodified against the shim headers in
+ * include/, which sim.c implements. Time is virtual: the radio is modelled as
+ * advertising events, scan windows and connection events, and the client
+ * code runs in between them. See README.md for what is and is not modelled.
+ */
+
+struct sim_config {
+    int peripherals; // simulated servers advertising the DEVICE uuid
+    int missing;     // devices the client looks for on top, that never appear
+    int rate_hz;     // notifications per second per server
+    int payload;     // bytes per notification, at most 20 (default ATT MTU)
+    int churn_ms;    // mean link lifetime before the server drops it, 0 never
+    int duration_ms; // of the measurement, teardown comes on top
+    int heap_limit;  // bytes of k_malloc, 0 is unlimited
+    u32_t seed;
+    bool verbose;    // print the client's printk output to stderr
+};
+
+/* Growable array of samples, in host memory so it does not count as heap */
+struct sim_samples {
+    u32_t* v;
+    u32_t n;
+    u32_t size;
+};
+
+struct sim_results {
+    /* notifications */
+    u32_t offered;           // produced by the servers
+    u32_t delivered;         // reached the program through runtime_step
+    u32_t lost_unconnected;  // produced while the server had no link
+    u32_t lost_unsubscribed; // produced before the client subscribed
+    u32_t dropped_queue;     // server transmit queue was full
+    u32_t dropped_link;      // still queued when the link went down
+    u32_t dropped_stack;     // handed to the client, never reached the program
+    u32_t recovered;         // reached the program through a catch-up run
+    struct sim_samples latency_us;  // from production to runtime_step, virtual
+    struct sim_samples dispatch_ns; // host time spent in the notify callback
+
+    /* links */
+    u32_t connects;
+    u32_t connect_failures;
+    u32_t disconnects;
+    struct sim_samples ready_ms;    // from link up to its first delivery
+
+    /* radio */
+    u64_t scan_us;           // in scan windows
+    u32_t events_skipped;    // connection events lost to a scan window
+    u32_t skip_run_max;      // most events one link lost in a row
+
+    /* heap */
+    u32_t heap_baseline;     // live after start_bt
+    u32_t heap_live;
+    u32_t heap_peak;
+    u32_t heap_allocs;
+    u32_t heap_failures;     // k_malloc returned NULL
+
+    u32_t conn_refs_leaked;  // references held on links that are down
+};
+
+void sim_init(const struct sim_config* config);
+
+/* Runs the event loop for ms of virtual time */
+void sim_run(s64_t ms);
+
+/* Marks the heap in use as the baseline that leaks are measured against */
+void sim_mark_heap_baseline(void);
+
+/* The servers drop their links and stop advertising, then the client gets
+ * time to clean up before the heap is compared against the baseline.
+ */
+void sim_teardown(void);
+
+const struct sim_results* sim_results(void);
+
+#endif
@@ -0,0 +1,123 @@
+/* window.cpp - Check of programs::window against blexa_step
+ *
+ * Steps the window program of ../common/programs.hpp, written with
+ * lustre.hpp, and blexa_step, which DSLustre generated from the same
+ * program, from one random trace of inputs. Every output is compared, and
+ * the size of their memory. Also times a step of each. The result is
+ * written to stdout as one JSON object, see README.md, and the exit status
+ * is 1 if they differ.
+ */
+
+extern "C" {
+#include "blexa.h"
+}
+#include "programs.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef BENCH_REVISION
+#define BENCH_REVISION "unknown"
+#endif
+
+// ticks of inputs generated up front, the timed runs cycle through them
+#define TRACE_TICKS 4096
+
+static unsigned rand_state;
+
+static unsigned random_below(unsigned n) {
+    // xorshift32, the same sequence on every host, as batch.c
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state % n;
+}
+
+static double now_ns(void) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/* Temperatures around the threshold of 30, and octavius mostly 0 (no
+ * change). blexa_step is only defined for octavius 0, 1 and 2.
+ */
+static void make_trace(int* a, int* b, int n) {
+    for(int i = 0; i < n; i++) {
+        a[i] = 20 + random_below(21);
+        b[i] = random_below(8) < 6 ? 0 : 1 + random_below(2);
+    }
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "usage: %s [-t steps] [-s seed]\n"
+            "\n"
+            "  -t is the number of steps compared, and timed\n",
+            name);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    static int a[TRACE_TICKS], b[TRACE_TICKS];
+    long steps = 1L << 20;
+    unsigned seed = 1;
+    long mismatches = 0;
+    long checksum = 0;
+    double start, scalar_ns, lustre_ns;
+    int opt;
+
+    while((opt = getopt(argc, argv, "t:s:")) != -1) {
+        switch(opt) {
+        case 't': steps = atol(optarg); break;
+        case 's': seed = strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]);
+        }
+    }
+    if(steps <= 0) {
+        usage(argv[0]);
+    }
+
+    struct blexa_mem mem;
+    lustre::program window(programs::window());
+
+    // compared on a fresh trace for every step
+    rand_state = seed ? seed : 1;
+    blexa_reset(&mem);
+    for(long t = 0; t < steps; t++) {
+        make_trace(a, b, 1);
+        mismatches += blexa_step(&mem, a[0], b[0]) != window.step(a[0], b[0]);
+    }
+
+    // timed on a trace made up front, without the cost of the random numbers
+    rand_state = seed ? seed : 1;
+    make_trace(a, b, TRACE_TICKS);
+
+    blexa_reset(&mem);
+    start = now_ns();
+    for(long t = 0; t < steps; t++) {
+        checksum += blexa_step(&mem, a[t % TRACE_TICKS], b[t % TRACE_TICKS]);
+    }
+    scalar_ns = now_ns() - start;
+
+    window.reset();
+    start = now_ns();
+    for(long t = 0; t < steps; t++) {
+        checksum -= window.step(a[t % TRACE_TICKS], b[t % TRACE_TICKS]);
+    }
+    lustre_ns = now_ns() - start;
+
+    bool same = !mismatches && !checksum &&
+                sizeof(window.memory()) == sizeof(struct blexa_mem);
+    printf("{\"revision\":\"%s\",\"steps\":%ld,\"seed\":%u,"
+           "\"mismatches\":%ld,\"checksum\":%ld,"
+           "\"state_bytes\":%zu,\"blexa_mem_bytes\":%zu,"
+           "\"lustre_ns\":%g,\"scalar_ns\":%g}\n",
+           BENCH_REVISION, steps, seed, mismatches, checksum,
+           sizeof(window.memory()), sizeof(struct blexa_mem),
+           lustre_ns / steps, scalar_ns / steps);
+    return same ? 0 : 1;
+}
@@ -20,6 +20,9 @@ void unregister_disconnected_callback();
 
 void try_connect(int uuid_in_hex);
 
+/* Copies the 6 byte address of the device at the other end to addr */
+int get_peer_address(struct conn* conn, unsigned char addr[6]);
+
 /* Characteristic management */
 /*
  * The connection object and subscribe parameters are void*
@@ -35,14 +38,48 @@ struct value {
     int service_uuid;
     int characteristic_uuid;
     int characteristic_handle;
+    int conn_key; // the key of the struct conn the value was found on
     void* conn;
     void* subscribe_params;
 };
 
+/* The callback runs on the system work queue once the characteristic and its
+ * CCC have been found. The value belongs to the connection and stays valid
+ * until the connection goes down. A discovery that keeps failing is given up
+ * and the callback is not invoked.
+ */
 typedef void(*scan_cb)(struct value* val);
 
 void scan_for_characteristic(struct conn* conn, int service_in_hex, int characteristic_in_hex, scan_cb cb);
 
 typedef void(subscribed_cb)(const void* buf, int len); // should probably (definitely) be u16_t
 int subscribe_characteristic(struct value* val, subscribed_cb cb);
+
+/* Like subscribe_characteristic, but the callback is also told which value
+ * was notified, for when the same characteristic is subscribed to on many
+ * connections.
+ */
+typedef void(subscribed_value_cb)(struct value* val, const void* buf, int len);
+int subscribe_characteristic_value(struct value* val, subscribed_value_cb cb);
 int unsubscribe_characteristic(struct value* val);
+
+/* Writes at most WRITE_MAX bytes to the value, with a response. The callback
+ * runs on the Bluetooth thread with 0 or the ATT error, also when the link
+ * went down first. There is one write in flight per value, -EBUSY otherwise.
+ */
+#define WRITE_MAX 8
+
+typedef void(*written_cb)(struct value* val, int err);
+int write_characteristic(struct value* val, const void* buf, int len, written_cb cb);
+
+/* Observer mode */
+/*
+ * Devices can also publish values as service data in their advertising.
+ * When observing a uuid, the callback is invoked with the service data that
+ * follows the 16 bit uuid in every advertising report that carries it. No
+ * connection is made, so any number of observers can listen to one device.
+ */
+typedef void(*broadcast_cb)(const void* buf, int len);
+
+int observe_broadcasts(int uuid_in_hex, broadcast_cb cb);
+void stop_observing();
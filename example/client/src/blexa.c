@@ -0,0 +1,52 @@
+/* Generated by DSLustre, do not edit by hand. */
+
+#include "blexa.h"
+
+void (blexa_reset(struct blexa_mem (* self))) {
+  ((*(self)).l) = (0);
+}
+
+int (blexa_step(struct blexa_mem (* self), int a, int b)) {
+  int j;
+  int d;
+  int m;
+  int k;
+  int g;
+  int f;
+  int e;
+  int c;
+  int o;
+  int n;
+  int h;
+  switch (b) {
+    case (2): (j) = (2); break;
+    case (1): (j) = (1); break;
+    case (0): (j) = (0); break;
+  };
+  (f) = ((*(self)).l);
+  (d) = (j);
+  switch (d) {
+    case (2): (k) = (1); break;
+    case (1): (k) = (0); break;
+    case (0): (k) = (f); break;
+  };
+  (e) = (k);
+  switch (b) {
+    case (2): (m) = (1); break;
+    case (1): (m) = (0); break;
+    case (0): (m) = (e); break;
+  };
+  (g) = (m);
+  ((*(self)).l) = (e);
+  (c) = ((a) > (30));
+  switch (c) {
+    case (1): (n) = (1); break;
+    case (0): (n) = (0); break;
+  };
+  switch (g) {
+    case (1): (o) = (n); break;
+    case (0): (o) = (2); break;
+  };
+  (h) = (o);
+  return h;
+}
@@ -0,0 +1,13 @@
+#ifndef BLEXA_BLE
+#define BLEXA_BLE
+
+/* Generated by DSLustre, do not edit by hand. */
+
+struct blexa_mem
+{ int l;
+};
+
+void (blexa_reset(struct blexa_mem (* self)));
+int (blexa_step(struct blexa_mem (* self), int a, int b));
+
+#endif
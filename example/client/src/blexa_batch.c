@@ -0,0 +1,26 @@
+#include "blexa_batch.h"
+
+#include <string.h>
+
+void blexa_batch_reset(struct blexa_batch* self) {
+    memset(self->l, 0, BLEXA_BATCH_SIZE(self->n) * sizeof(self->l[0]));
+}
+
+static void step_block(int* restrict l, const int* restrict a,
+                       const int* restrict b, int* restrict out) {
+    for(int i = 0; i < BLEXA_BATCH_BLOCK; i++) {
+        // 2 gives permission, 1 withdraws it, anything else keeps it
+        int keep = (b[i] != 1) & (b[i] != 2);
+        int e = (b[i] == 2) | (keep & l[i]);
+
+        l[i] = e;
+        // (a > 30) while permitted, 2 otherwise; -e and e - 1 are masks
+        out[i] = ((a[i] > 30) & -e) | (2 & (e - 1));
+    }
+}
+
+void blexa_batch_step(struct blexa_batch* self, const int* a, const int* b, int* out) {
+    for(int i = 0; i < self->n; i += BLEXA_BATCH_BLOCK) {
+        step_block(&self->l[i], &a[i], &b[i], &out[i]);
+    }
+}
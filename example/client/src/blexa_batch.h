@@ -0,0 +1,39 @@
+#ifndef BLEXA_BATCH_BLE
+#define BLEXA_BATCH_BLE
+
+/* Many independent instances of blexa_step, stepped together.
+ *
+ * Written by hand from the generated blexa.c, which it has to follow when
+ * the program changes. The memories of the instances are kept as a structure
+ * of arrays, one array per field of struct blexa_mem, and so are the inputs
+ * and outputs of a step: instance i has memory l[i], inputs a[i] and b[i],
+ * and output out[i]. The switch chains of blexa_step are written as
+ * arithmetic on the comparisons, so a step has no branches per instance.
+ *
+ * Instances are stepped BLEXA_BATCH_BLOCK at a time. A loop with that fixed
+ * trip count is one the compiler vectorizes at -O2 already, where a loop
+ * over n instances needs -O3 for its remainder. The arrays are therefore
+ * sized with BLEXA_BATCH_SIZE(n), and the instances past n are stepped as
+ * well, with whatever inputs the caller left there.
+ *
+ * For b of 0, 1 and 2 an instance steps as blexa_step does. Any other b
+ * leaves the memory as 0 does, where blexa_step leaves its locals unset.
+ */
+
+#define BLEXA_BATCH_BLOCK 16
+#define BLEXA_BATCH_SIZE(n) \
+    (((n) + BLEXA_BATCH_BLOCK - 1) / BLEXA_BATCH_BLOCK * BLEXA_BATCH_BLOCK)
+
+struct blexa_batch {
+    int* l;     // blexa_mem.l of every instance
+    int n;      // number of instances
+};
+
+void blexa_batch_reset(struct blexa_batch* self);
+
+/* Steps every instance once. a, b and out hold BLEXA_BATCH_SIZE(self->n)
+ * elements each, out must not overlap the others.
+ */
+void blexa_batch_step(struct blexa_batch* self, const int* a, const int* b, int* out);
+
+#endif
@@ -18,9 +18,14 @@
 #include <bluetooth/uuid.h>
 #include <bluetooth/gatt.h>
 #include <sys/byteorder.h>
+#include <settings/settings.h>
+#include <random/rand32.h>
 
 #include "api.h"
 #include "stack.h"
+#include "linkstats.h"
+// last, it replaces k_malloc and k_free
+#include "heapstats.h"
 
 // concurrent connections
 #define MAX_CONNECTIONS 5
@@ -72,8 +77,11 @@ struct bt_conn* get_conn(int key) {
     return res;
 }
 
+/* -1 if the connection is not one of ours, e.g. a link on which a gateway
+ * is the peripheral
+ */
 int get_key(struct bt_conn* conn) {
-    int res = 0;
+    int res = -1;
 
     for(int i = 0; i < MAX_CONNECTIONS; i++) {
         if(conn == conns[i]) {
@@ -89,182 +97,451 @@ void recycle_key(int key) {
     conns[key] = NULL;
     push(stack, key);
 }
+
+int get_peer_address(struct conn* conn, unsigned char addr[6]) {
+    struct bt_conn* c = get_conn(conn->key);
+
+    if(!c) {
+        return -ENOTCONN;
+    }
+    memcpy(addr, bt_conn_get_dst(c)->a.val, sizeof(bt_addr_t));
+    return 0;
+}
+/*********************************************/
+/*********** Security ***********/
+/* Links are encrypted as soon as they are established. Bonds are persisted
+ * through the settings subsystem (CONFIG_BT_SETTINGS), so when we reconnect
+ * to a peer we have paired with before, the stored LTK is used to encrypt the
+ * link directly and no pairing takes place.
+ *
+ * The time from starting to connect until the link is encrypted is reported
+ * separately for bonded and freshly paired links. Build with
+ * CONFIG_BT_BONDABLE=n to measure reconnects without bonding.
+ */
+
+struct security_timing {
+    u32_t links;
+    u32_t total_ms;
+};
+
+static u32_t connect_started[MAX_CONNECTIONS];
+static bool connect_bonded[MAX_CONNECTIONS];
+static struct security_timing timings[2]; // indexed by connect_bonded
+
+static void bond_found(const struct bt_bond_info* info, void* user_data) {
+    struct bt_conn* conn = user_data;
+    if(!bt_addr_le_cmp(&info->addr, bt_conn_get_dst(conn))) {
+        connect_bonded[get_key(conn)] = true;
+    }
+}
+
+static void secure_link(struct bt_conn* conn) {
+    connect_bonded[get_key(conn)] = false;
+    bt_foreach_bond(BT_ID_DEFAULT, bond_found, conn);
+
+    int err = bt_conn_set_security(conn, BT_SECURITY_L2);
+    if(err) {
+        printk("Failed to set security (err %d)\n", err);
+    }
+}
+
+static void security_changed(struct bt_conn *conn, bt_security_t level,
+			     enum bt_security_err err) {
+	char addr[BT_ADDR_LE_STR_LEN];
+	int key = get_key(conn);
+
+	if (key == -1) {
+		return;
+	}
+
+	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
+
+	if (err) {
+		printk("Security failed: %s level %u (err %d)\n", addr, level, err);
+		if (err == BT_SECURITY_ERR_PIN_OR_KEY_MISSING) {
+			/* The peer lost its bond. Forgetting ours drops the
+			 * link, and we pair from scratch when we reconnect.
+			 */
+			bt_unpair(BT_ID_DEFAULT, bt_conn_get_dst(conn));
+		}
+		return;
+	}
+
+	struct security_timing* timing = &timings[connect_bonded[key]];
+	u32_t ms = k_uptime_get_32() - connect_started[key];
+
+	timing->links++;
+	timing->total_ms += ms;
+	printk("[SECURITY] %s level %u after %u ms (%s), average %u ms over %u links\n",
+	       addr, level, ms, connect_bonded[key] ? "bonded" : "paired",
+	       timing->total_ms / timing->links, timing->links);
+}
 /*********************************************/
+/*********** Discovery ***********/
 /*
  * When you scan for a characteristic the intention is that you get a value back
  * which can be used to initiate communication and/or subscribe events.
- * While the search is taking place, a struct target object is created to
- * keep track of what we are looking for. As we find more and more information
- * about the remote device we update the discovery & subscription parameters.
+ * While the search is taking place, a struct target keeps track of what we
+ * are looking for. Finding a characteristic takes three steps: the primary
+ * service by its uuid, the characteristic within that service and then its
+ * CCC descriptor.
  *
- * To scan for more than 1 characteristic simultaneously we keep a list of
- * targets. The discovery callback knows which discover parameters were used
- * to scan, which we can use to uniquely identify the right target in the list.
+ * Every connection has a fixed number of targets and one delayed work item
+ * on the system work queue that drives all of them. The discovery callback
+ * only records what the stack found and kicks the work item, which takes the
+ * next step. So no discovery is issued from inside the callback of another,
+ * and the targets of a connection run in parallel. The work item hands the
+ * requests to the stack after releasing the lock that the callback takes.
+ * With Enhanced ATT (CONFIG_BT_EATT) the stack sends their requests on
+ * separate bearers, so a device with many services is ready after fewer
+ * connection events.
  *
- * When we found every piece of information required we deallocate the
- * struct target, but place the subscribe parameters and some other information
- * in a struct value* object that is passed back through to the caller via the
- * scan callback, found in the target struct.
+ * A step that is not answered within STEP_TIMEOUT_MS, that ends without
+ * finding its attribute or that the stack refuses, is retried after
+ * RETRY_DELAY_MS, at most STEP_ATTEMPTS times. Zephyr cannot cancel a
+ * discovery, so a step that timed out leaves its request with the stack and
+ * the retry uses the other request of the target. Whatever the stale
+ * request reports later is ignored. When the connection goes down its
+ * targets are cancelled.
+ *
+ * When we found every piece of information required, the subscribe
+ * parameters and some other information are placed in the struct value of
+ * the target, which is passed to the caller through the scan callback. The
+ * value stays valid until the connection goes down.
  *
  * Scanning for a characteristic only probes the remote device. It does not
  * send or read the characteristic in question. These things can be done through
  * the API by using the struct value object.
  */
 
+#define MAX_TARGETS     4     // scans per connection
+#define STEP_TIMEOUT_MS 5000
+#define STEP_ATTEMPTS   3
+#define RETRY_DELAY_MS  200
+
+enum step {
+    STEP_SERVICE,
+    STEP_CHARACTERISTIC,
+    STEP_CCC,
+    STEP_DONE,
+};
+
+static const char* const step_names[] = { "service", "characteristic", "CCC" };
+
+/* A discovery the stack may still be holding on to */
+struct request {
+    struct bt_gatt_discover_params params;
+    struct bt_uuid_16 uuid;
+    struct target* target;
+    bool busy;
+};
+
+/* The application callback of a subscription, see Subscription management.
+ * Every target has one for its value, so subscribing does not allocate.
+ */
+struct callback {
+    subscribed_cb* cb;
+    subscribed_value_cb* value_cb;
+    struct bt_conn* conn;
+    struct value* value;
+    struct node node;
+    bool linked;              // node is in callbacks
+};
+
 struct target {
+    bool used;
     int service_uuid;
     int characteristic_uuid;
     scan_cb scancb;
-    struct bt_uuid_16 uuid;
-    struct bt_gatt_discover_params* discover_parameters;
-    struct bt_gatt_subscribe_params* subscribe_parameters;
+    struct discovery* discovery;
+
+    enum step step;
+    u8_t attempts;            // of the current step
+    struct request requests[2];
+    struct request* current;  // the step in flight, NULL when there is none
+    bool finished;            // the current request has ended
+    bool found;               // and found its attribute
+    s64_t deadline;           // uptime in ms, of the step in flight or the retry
+
+    u16_t start_handle;
+    u16_t end_handle;         // of the service
+    struct bt_gatt_subscribe_params subscribe_params;
+    struct value value;
+    struct callback callback;
+
+    struct bt_gatt_write_params write_params;
+    u8_t write_buf[WRITE_MAX];
+    written_cb writecb;
+    bool writing;             // the stack holds write_params, under discovery_lock
 };
 
-int eqParams(struct target* t, struct bt_gatt_discover_params* params) {
-    return t->discover_parameters == params;
-}
-
-K_MUTEX_DEFINE(targets_lock);
-struct node* targets;
-
-void insert_into_targets(struct target* t) {
-    k_mutex_lock(&targets_lock, K_FOREVER);
-    struct node* new = k_malloc(sizeof(struct target));
-    new->data = t;
+struct discovery {
+    int key;
+    struct target targets[MAX_TARGETS];
+    struct k_delayed_work work;
+};
 
-    struct node* list = targets;
-    
-    if(!list) {
-        targets = new;
-    } else {
-        while(list->next) {
-            list = list->next;
+K_MUTEX_DEFINE(discovery_lock);
+static struct discovery discoveries[MAX_CONNECTIONS];
+
+static u8_t discover_func(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                          struct bt_gatt_discover_params* params) {
+    struct request* req = CONTAINER_OF(params, struct request, params);
+    struct target* t = req->target;
+
+    k_mutex_lock(&discovery_lock, K_FOREVER);
+    // returning BT_GATT_ITER_STOP or attr == NULL both end the discovery
+    req->busy = false;
+    if(t->current == req && !t->finished) {
+        if(attr) {
+            switch(t->step) {
+            case STEP_SERVICE: {
+                struct bt_gatt_service_val* serv = attr->user_data;
+                t->start_handle = attr->handle + 1;
+                t->end_handle = serv->end_handle;
+                break;
+            }
+            case STEP_CHARACTERISTIC:
+                t->subscribe_params.value_handle = bt_gatt_attr_value_handle(attr);
+                t->start_handle = t->subscribe_params.value_handle + 1;
+                break;
+            default:
+                t->subscribe_params.ccc_handle = attr->handle;
+                break;
+            }
+            t->found = true;
         }
-	list->next = new;
+        t->finished = true;
+        k_delayed_work_submit(&t->discovery->work, K_NO_WAIT);
     }
-    k_mutex_unlock(&targets_lock);
+    k_mutex_unlock(&discovery_lock);
+    return BT_GATT_ITER_STOP;
 }
 
-void remove_from_targets(struct bt_gatt_discover_params* params) {
-    k_mutex_lock(&targets_lock, K_FOREVER);
-    struct node* list = targets;
+/* Must hold discovery_lock */
+static void step_failed(struct target* t, struct bt_conn* conn, s64_t now) {
+    t->current = NULL;
+    link_stats_error(conn);
+    if(++t->attempts < STEP_ATTEMPTS) {
+        t->deadline = now + RETRY_DELAY_MS;
+        return;
+    }
+    printk("Discovery of %04x in service %04x failed at the %s\n",
+           t->characteristic_uuid, t->service_uuid, step_names[t->step]);
+    t->used = false;
+}
 
-    if(targets && eqParams(targets->data, params)) {
-        struct node* old = targets;
-        struct target* t = targets->data;
+/* Must hold discovery_lock. Prepares the request of the current step, which
+ * the caller hands to the stack once it has released the lock.
+ */
+static struct request* issue_step(struct target* t, s64_t now) {
+    struct request* req = NULL;
+    struct bt_gatt_discover_params* params;
+
+    for(int i = 0; i < ARRAY_SIZE(t->requests); i++) {
+        if(!t->requests[i].busy) {
+            req = &t->requests[i];
+            break;
+        }
+    }
+    if(!req) {
+        // both requests timed out and the stack still has them
+        t->deadline = now + RETRY_DELAY_MS;
+        return NULL;
+    }
 
-	targets = targets->next;
-	k_free(old);
-	k_free(t);
-    } else if(targets) {
-        while(list->next) {
-            if(eqParams(list->next->data, params)) {
-                struct node* old = list->next;
-		struct target* t = list->next->data;
+    params = &req->params;
+    memset(params, 0, sizeof(*params));
+    params->func = discover_func;
+    params->uuid = &req->uuid.uuid;
+    params->start_handle = t->start_handle;
+    params->end_handle = t->end_handle;
+    switch(t->step) {
+    case STEP_SERVICE:
+        memcpy(&req->uuid, BT_UUID_DECLARE_16(t->service_uuid), sizeof(req->uuid));
+        params->type = BT_GATT_DISCOVER_PRIMARY;
+        break;
+    case STEP_CHARACTERISTIC:
+        memcpy(&req->uuid, BT_UUID_DECLARE_16(t->characteristic_uuid), sizeof(req->uuid));
+        params->type = BT_GATT_DISCOVER_CHARACTERISTIC;
+        break;
+    default:
+        memcpy(&req->uuid, BT_UUID_GATT_CCC, sizeof(req->uuid));
+        params->type = BT_GATT_DISCOVER_DESCRIPTOR;
+        break;
+    }
 
-		list->next = list->next->next;
-		k_free(old);
-		k_free(t);
-		break;
-	    }
-	}
-	list = list->next;
+    t->current = req;
+    t->finished = false;
+    t->found = false;
+    t->deadline = now + STEP_TIMEOUT_MS;
+    req->busy = true;
+    return req;
+}
+
+/* The stack refused the request, unless the target was cancelled meanwhile
+ * its step failed
+ */
+static void refused(struct request* req, struct bt_conn* conn, int err, s64_t now) {
+    struct target* t = req->target;
+
+    k_mutex_lock(&discovery_lock, K_FOREVER);
+    req->busy = false;
+    if(t->current == req) {
+        printk("Discover %s failed (err %d)\n", step_names[t->step], err);
+        step_failed(t, conn, now);
     }
-    k_mutex_unlock(&targets_lock);
+    k_mutex_unlock(&discovery_lock);
 }
 
-struct target* find_target(struct bt_gatt_discover_params* params) {
-    k_mutex_lock(&targets_lock, K_FOREVER);
-    struct target* res = NULL;
+/* Must hold discovery_lock. Returns true when the target is found, issued
+ * is set to a request that is to be sent.
+ */
+static bool advance(struct target* t, struct bt_conn* conn, s64_t now,
+                    struct request** issued) {
+    if(t->current && t->finished && t->found) {
+        t->current = NULL;
+        t->attempts = 0;
+        t->step++;
+        t->deadline = now;
+    } else if(t->current && t->finished) {
+        printk("Discover %s found nothing\n", step_names[t->step]);
+        step_failed(t, conn, now);
+    } else if(t->current && now >= t->deadline) {
+        printk("Discover %s timed out\n", step_names[t->step]);
+        step_failed(t, conn, now);
+    }
 
-    struct node* tgs = targets;
-    while(tgs) {
-        struct target* t = tgs->data;
-        if(t->discover_parameters == params) {
-            res = t;
-	    break;
-	}
-	tgs = tgs->next;
+    if(!t->used || t->current || now < t->deadline) {
+        return false;
     }
-    k_mutex_unlock(&targets_lock);
-    return res;
+    if(t->step != STEP_DONE) {
+        *issued = issue_step(t, now);
+        return false;
+    }
+
+    struct value* val = &t->value;
+    val->service_uuid          = t->service_uuid;
+    val->characteristic_uuid   = t->characteristic_uuid;
+    val->characteristic_handle = t->subscribe_params.value_handle;
+    val->conn                  = conn;
+    val->conn_key              = t->discovery->key;
+    val->subscribe_params      = &t->subscribe_params;
+    t->subscribe_params.value  = BT_GATT_CCC_NOTIFY;
+    // we discover again after a reconnect, the stack need not keep it
+    atomic_set_bit(t->subscribe_params.flags, BT_GATT_SUBSCRIBE_FLAG_VOLATILE);
+    t->deadline = -1;
+    return true;
 }
 
-static u8_t characteristic_found(struct bt_conn* conn,
-		                 const struct bt_gatt_attr* attr,
-				 struct bt_gatt_discover_params* params) { 
-    if(!attr) {
-        printk("Discovery reached attr == NULL\n");
-	return BT_GATT_ITER_STOP;
+static void discovery_work(struct k_work* work) {
+    struct discovery* d = CONTAINER_OF(work, struct discovery, work.work);
+    struct bt_conn* conn = get_conn(d->key);
+    struct target* found[MAX_TARGETS];
+    struct request* issued[MAX_TARGETS];
+    int n_found = 0;
+    int n_issued = 0;
+    s64_t now = k_uptime_get();
+    s64_t next = -1;
+
+    if(!conn) {
+        return;
     }
 
-    printk("[ATTRIBUTE] handle %u\n", attr->handle);
-
-    struct target* target = find_target(params);
+    k_mutex_lock(&discovery_lock, K_FOREVER);
+    for(int i = 0; i < MAX_TARGETS; i++) {
+        struct target* t = &d->targets[i];
+        struct request* req = NULL;
 
-    if(!bt_uuid_cmp(params->uuid, BT_UUID_DECLARE_16(target->service_uuid))) {
-	struct bt_gatt_service_val* serv = attr->user_data;
-        memcpy(&target->uuid, BT_UUID_DECLARE_16(target->characteristic_uuid), sizeof(target->uuid));
-	target->discover_parameters->uuid = &target->uuid.uuid;
-	target->discover_parameters->start_handle = attr->handle + 1;
-	target->discover_parameters->end_handle = serv->end_handle;
-	target->discover_parameters->type = BT_GATT_DISCOVER_CHARACTERISTIC;
+        if(!t->used || t->deadline < 0) {
+            continue;
+        }
+        if(advance(t, conn, now, &req)) {
+            found[n_found++] = t;
+        } else if(t->used && (next < 0 || t->deadline < next)) {
+            next = t->deadline;
+        }
+        if(req) {
+            issued[n_issued++] = req;
+        }
+    }
+    k_mutex_unlock(&discovery_lock);
 
-	bt_gatt_discover(conn, target->discover_parameters);
-    } else if(!bt_uuid_cmp(params->uuid, BT_UUID_DECLARE_16(target->characteristic_uuid))) {
-        memcpy(&target->uuid, BT_UUID_GATT_CCC, sizeof(target->uuid));
-	target->discover_parameters->uuid = &target->uuid.uuid;
-	target->discover_parameters->start_handle = attr->handle + 2;
-	target->discover_parameters->type = BT_GATT_DISCOVER_DESCRIPTOR;
-	target->subscribe_parameters->value_handle = bt_gatt_attr_value_handle(attr);
+    // the stack may wait for a buffer, and discover_func takes the lock
+    for(int i = 0; i < n_issued; i++) {
+        int err = bt_gatt_discover(conn, &issued[i]->params);
+        if(err) {
+            refused(issued[i], conn, err, now);
+            if(next < 0 || now + RETRY_DELAY_MS < next) {
+                next = now + RETRY_DELAY_MS;
+            }
+        }
+    }
 
-	bt_gatt_discover(conn, target->discover_parameters);
-    } else {
-	target->subscribe_parameters->value = BT_GATT_CCC_NOTIFY;
-	target->subscribe_parameters->ccc_handle = attr->handle;
+    if(next >= 0) {
+        k_delayed_work_submit(&d->work, K_MSEC(MAX(next - now, 0)));
+    }
 
+    // the callbacks may subscribe, which must not happen under the lock
+    for(int i = 0; i < n_found; i++) {
         printk("Discovery complete\n");
-	struct value* val = k_malloc(sizeof(struct value));
-
-	val->service_uuid          = target->service_uuid;
-	val->characteristic_uuid   = target->characteristic_uuid;
-	val->characteristic_handle = target->subscribe_parameters->value_handle;
-	val->conn                  = conn;
-	val->subscribe_params      = (void*)target->subscribe_parameters;
-	if(target->scancb) {
-            (target->scancb)(val);
-	}
-	remove_from_targets(params);
-
-	return BT_GATT_ITER_STOP;
+        if(found[i]->scancb) {
+            (found[i]->scancb)(&found[i]->value);
+        }
     }
-    return BT_GATT_ITER_STOP;
 }
 
 void scan_for_characteristic(struct conn* conn, int service_in_hex, int characteristic_in_hex, scan_cb cb) {
-    struct target* t = k_malloc(sizeof(struct target));
+    struct discovery* d = &discoveries[conn->key];
+    struct target* t = NULL;
+
+    k_mutex_lock(&discovery_lock, K_FOREVER);
+    for(int i = 0; i < MAX_TARGETS; i++) {
+        struct target* candidate = &d->targets[i];
+        // a request the stack still holds or a subscribed callback must
+        // not be overwritten
+        if(!candidate->used && !candidate->requests[0].busy &&
+           !candidate->requests[1].busy && !candidate->writing &&
+           !candidate->callback.linked) {
+            t = candidate;
+            break;
+        }
+    }
+    if(!t) {
+        k_mutex_unlock(&discovery_lock);
+        printk("Too many scans on connection %d, at most %d\n", conn->key, MAX_TARGETS);
+        return;
+    }
+
+    memset(t, 0, sizeof(*t));
+    t->used = true;
     t->service_uuid = service_in_hex;
     t->characteristic_uuid = characteristic_in_hex;
     t->scancb = cb;
+    t->discovery = d;
+    t->step = STEP_SERVICE;
+    t->start_handle = 0x0001;
+    t->end_handle = 0xffff;
+    for(int i = 0; i < ARRAY_SIZE(t->requests); i++) {
+        t->requests[i].target = t;
+    }
+    k_mutex_unlock(&discovery_lock);
+
+    k_delayed_work_submit(&d->work, K_NO_WAIT);
+}
 
-    t->uuid.uuid.type = 0;
-    t->uuid.val = 0;
-	
-    struct bt_gatt_discover_params* params = k_malloc(sizeof(struct bt_gatt_discover_params));
-    memcpy(&(t->uuid), BT_UUID_DECLARE_16(t->service_uuid), sizeof(t->uuid));
-    params->uuid = &(t->uuid.uuid);
-    params->func = characteristic_found;
-    params->start_handle = 0x0001;
-    params->end_handle = 0xffff;
-    params->type = BT_GATT_DISCOVER_PRIMARY;
-    t->discover_parameters = params;
-
-    struct bt_gatt_subscribe_params* subscribe_params = k_malloc(sizeof(struct bt_gatt_subscribe_params));
-    t->subscribe_parameters = subscribe_params;
-
-    insert_into_targets(t);
-    bt_gatt_discover(get_conn(conn->key), t->discover_parameters);
-}    
+/* The link is down, the stack ends the outstanding discoveries */
+static void cancel_discovery(int key) {
+    struct discovery* d = &discoveries[key];
+
+    k_delayed_work_cancel(&d->work);
+    k_mutex_lock(&discovery_lock, K_FOREVER);
+    for(int i = 0; i < MAX_TARGETS; i++) {
+        d->targets[i].used = false;
+        d->targets[i].current = NULL;
+    }
+    k_mutex_unlock(&discovery_lock);
+}
 /*********************************************/
 /********** Subscription management **********/
 /*
@@ -278,24 +555,18 @@ void scan_for_characteristic(struct conn* conn, int service_in_hex, int characte
  * the number of callbacks we can register.
  */
 
-struct callback {
-    subscribed_cb* cb;
-    struct bt_conn* conn;
-    struct value* value;
-};
-
 K_MUTEX_DEFINE(callbacks_lock);
 struct node* callbacks;
 
-subscribed_cb* find_callback(struct bt_conn* conn, struct bt_gatt_subscribe_params* params) {
+struct callback* find_callback(struct bt_conn* conn, struct bt_gatt_subscribe_params* params) {
     k_mutex_lock(&callbacks_lock, K_FOREVER);
-    subscribed_cb* res = NULL;
+    struct callback* res = NULL;
 
     struct node* cbs = callbacks;
     while(cbs) {
         struct callback* cb = cbs->data;
         if(conn == cb->conn && params->value_handle == cb->value->characteristic_handle) {
-            res = cb->cb;
+            res = cb;
 	    break;
 	}
         cbs = cbs->next;
@@ -308,67 +579,67 @@ void delete_callback(struct value* val) {
     k_mutex_lock(&callbacks_lock, K_FOREVER);
     struct bt_conn* conn = val->conn;
 
-    struct node* cbs = callbacks;
-    if(cbs) {
-        struct callback* cb = cbs->data;
+    struct node** link = &callbacks;
+    while(*link) {
+        struct node* n = *link;
+        struct callback* cb = n->data;
 	if(cb->conn == conn && cb->value->characteristic_handle == val->characteristic_handle) {
-            struct node* n = cbs;
-	    cbs = cbs->next;
-	    k_free(cb);
-	    k_free(n);
-	    callbacks = cbs;
+	    *link = n->next;
+	    cb->linked = false;
+	    break;
 	}
-    } else if(cbs) {
-        while(cbs) {
-	    struct node* next_n = cbs->next;
-            struct callback* next_cb = next_n->data;
-            if(next_n && next_cb->conn == conn && next_cb->value->characteristic_handle == val->characteristic_handle) {
-                cbs->next = cbs->next->next;
-		k_free(next_cb);
-		k_free(next_n);
-                k_mutex_unlock(&callbacks_lock);
-		return;
-	    }
-	    cbs = next_n;
-        }
+	link = &n->next;
     }
     k_mutex_unlock(&callbacks_lock);
 }
 
+/* A value that is subscribed again keeps its place in the list */
 void insert_callback(struct callback* cb) {
     k_mutex_lock(&callbacks_lock, K_FOREVER);
-    struct node* new = (struct node*) k_malloc(sizeof(struct node));
-    new->data = cb;
-
-    struct node* cbs = callbacks;
-    if(!cbs) {
-        cbs = new;
-    } else {
-        while(cbs->next) {
-            cbs = cbs->next;
-	}
-	cbs->next = new;
+    if(!cb->linked) {
+        struct node** link = &callbacks;
+        while(*link) {
+            link = &(*link)->next;
+        }
+        cb->node.data = cb;
+        cb->node.next = NULL;
+        *link = &cb->node;
+        cb->linked = true;
     }
-    callbacks = cbs;
     k_mutex_unlock(&callbacks_lock);
 }
 
 static u8_t global_callback(struct bt_conn* conn, struct bt_gatt_subscribe_params* params, const void* data, u16_t length) {
-    subscribed_cb* cb = find_callback(conn, params);
-    if(cb && data) {
-        (*cb)(data, length);
+    struct callback* cb = find_callback(conn, params);
+    if(!data) {
+        // the stack dropped the subscription, e.g. the link went down
+        if(cb) {
+            delete_callback(cb->value);
+        }
+        return BT_GATT_ITER_STOP;
+    }
+    if(cb) {
+        link_stats_rx(conn, length);
+        if(cb->value_cb) {
+            (*cb->value_cb)(cb->value, data, length);
+        } else {
+            (*cb->cb)(data, length);
+        }
     } else {
-        printk("An error ocurred - received notification without a registered callback function or data is NULL\n");
+        link_stats_drop(conn);
+        printk("An error ocurred - received notification without a registered callback function\n");
     }
     return BT_GATT_ITER_CONTINUE;
 }
 
-int subscribe_characteristic(struct value* val, subscribed_cb cb) {
+static int subscribe(struct value* val, subscribed_cb cb, subscribed_value_cb value_cb) {
     struct bt_conn* conn = val->conn;
 
     if(conn) {
-        struct callback* callback = (struct callback*) k_malloc(sizeof(struct callback));
+        struct target* t = CONTAINER_OF(val, struct target, value);
+        struct callback* callback = &t->callback;
         callback->cb = cb;
+        callback->value_cb = value_cb;
         callback->conn = conn;
         callback->value = val;
 
@@ -378,7 +649,7 @@ int subscribe_characteristic(struct value* val, subscribed_cb cb) {
 	int err = bt_gatt_subscribe(conn, params);
 	if(err && err != -EALREADY) {
             printk("Subscribe failed\n");
-	    k_free(callback);
+	    link_stats_error(conn);
 	    return 1;
 	} else {
             printk("Subscribe succeeded\n");
@@ -391,6 +662,14 @@ int subscribe_characteristic(struct value* val, subscribed_cb cb) {
     }
 }
 
+int subscribe_characteristic(struct value* val, subscribed_cb cb) {
+    return subscribe(val, cb, NULL);
+}
+
+int subscribe_characteristic_value(struct value* val, subscribed_value_cb cb) {
+    return subscribe(val, NULL, cb);
+}
+
 int unsubscribe_characteristic(struct value* val) {
     struct bt_conn* conn = val->conn;
     struct bt_gatt_subscribe_params* params = val->subscribe_params;
@@ -401,11 +680,66 @@ int unsubscribe_characteristic(struct value* val) {
 
     if(err) {
         printk("Ubsubscribe failed\n");
+        link_stats_error(conn);
         return 1;
     } 
     return 0;
 }
 
+/* The value is part of the target that found it, so the write can use the
+ * buffers there
+ */
+static void write_func(struct bt_conn* conn, u8_t err, struct bt_gatt_write_params* params) {
+    struct target* t = CONTAINER_OF(params, struct target, write_params);
+    written_cb cb = t->writecb;
+
+    k_mutex_lock(&discovery_lock, K_FOREVER);
+    t->writing = false;
+    k_mutex_unlock(&discovery_lock);
+    if(err) {
+        link_stats_error(conn);
+    }
+    if(cb) {
+        cb(&t->value, err);
+    }
+}
+
+int write_characteristic(struct value* val, const void* buf, int len, written_cb cb) {
+    struct target* t = CONTAINER_OF(val, struct target, value);
+    struct bt_gatt_write_params* params = &t->write_params;
+
+    if(len < 0 || len > WRITE_MAX) {
+        return -EINVAL;
+    }
+
+    // scan_for_characteristic does not reuse a target that is writing
+    k_mutex_lock(&discovery_lock, K_FOREVER);
+    if(t->writing) {
+        k_mutex_unlock(&discovery_lock);
+        return -EBUSY;
+    }
+    t->writing = true;
+    k_mutex_unlock(&discovery_lock);
+
+    memcpy(t->write_buf, buf, len);
+    params->func = write_func;
+    params->handle = val->characteristic_handle;
+    params->offset = 0;
+    params->data = t->write_buf;
+    params->length = len;
+    t->writecb = cb;
+
+    int err = bt_gatt_write(val->conn, params);
+    if(err) {
+        printk("Write failed (err %d)\n", err);
+        link_stats_error(val->conn);
+        k_mutex_lock(&discovery_lock, K_FOREVER);
+        t->writing = false;
+        k_mutex_unlock(&discovery_lock);
+    }
+    return err;
+}
+
 /*********************************************/
 // TODO When I have another board so that I can test it, I'd like to rewrite this
 /* using the same trick as with characteristic scanning, keeping current scans
@@ -413,9 +747,27 @@ int unsubscribe_characteristic(struct value* val) {
  * device at a time.
  */
 
-static int target;
+static int target = -1;
 static int target_key;
-struct bt_uuid* t;
+
+/* See observe_broadcasts, the observer shares the scanner with try_connect */
+static int observed = -1;
+static broadcast_cb observer;
+
+/* See Reconnection, a failed attempt goes back into the queue */
+static void connect_done(struct bt_conn* conn, u8_t conn_err);
+static void resume_observer(void);
+
+static bool svc_data_found(struct bt_data *data, void *user_data)
+{
+	if (data->type == BT_DATA_SVC_DATA16 && data->data_len >= sizeof(u16_t) &&
+	    sys_get_le16(data->data) == observed) {
+		observer(&data->data[sizeof(u16_t)], data->data_len - sizeof(u16_t));
+		return false;
+	}
+
+	return true;
+}
 
 static bool eir_found(struct bt_data *data, void *user_data)
 {
@@ -441,10 +793,18 @@ static bool eir_found(struct bt_data *data, void *user_data)
 			memcpy(&u16, &data->data[i], sizeof(u16));
 			uuid = BT_UUID_DECLARE_16(sys_le16_to_cpu(u16));
 			if (bt_uuid_cmp(uuid, BT_UUID_DECLARE_16(target))) {
-			//if (bt_uuid_cmp(uuid, t)) {
 				continue;
 			}
 
+			/* Another device with the same uuid, which we
+			 * are already connected to
+			 */
+			struct bt_conn* existing = bt_conn_lookup_addr_le(BT_ID_DEFAULT, addr);
+			if (existing) {
+				bt_conn_unref(existing);
+				return false;
+			}
+
 			err = bt_le_scan_stop();
 			if (err) {
 				printk("Stop LE scan failed (err %d)\n", err);
@@ -452,10 +812,19 @@ static bool eir_found(struct bt_data *data, void *user_data)
 			}
 
 			param = BT_LE_CONN_PARAM_DEFAULT;
+			connect_started[target_key] = k_uptime_get_32();
 			err = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN,
 						param, &(conns[target_key]));
 			if (err) {
 				printk("Create conn failed (err %d)\n", err);
+
+				/* The scan is stopped and no connected callback
+				 * will come, requeue the uuid to scan again
+				 */
+				recycle_key(target_key);
+				target = -1;
+				connect_done(NULL, BT_HCI_ERR_UNSPECIFIED);
+				resume_observer();
 			}
 
 			return false;
@@ -473,38 +842,394 @@ static void device_found(const bt_addr_le_t *addr, s8_t rssi, u8_t type,
 	printk("[DEVICE]: %s, AD evt type %u, AD data len %u, RSSI %i\n",
 	       dev, type, ad->len, rssi);
 
+	/* Broadcasts come in any kind of advertising, also non-connectable.
+	 * Parsing consumes the buffer, so keep it for the connection code.
+	 */
+	if (observer) {
+		struct net_buf_simple_state state;
+
+		net_buf_simple_save(ad, &state);
+		bt_data_parse(ad, svc_data_found, NULL);
+		net_buf_simple_restore(ad, &state);
+	}
+
 	/* We're only interested in connectable events */
-	if (type == BT_GAP_ADV_TYPE_ADV_IND ||
-	    type == BT_GAP_ADV_TYPE_ADV_DIRECT_IND) {
+	if (target != -1 && (type == BT_GAP_ADV_TYPE_ADV_IND ||
+	    type == BT_GAP_ADV_TYPE_ADV_DIRECT_IND)) {
 		bt_data_parse(ad, eir_found, (void *)addr);
 	}
 }
 
-void try_connect(int uuid_in_hex) {
+/*********** Scan scheduling ***********/
+/* A device we look for may be gone for a long time, and every scan window
+ * is radio time that the links we have do not get. So a scan for a uuid
+ * starts fast, for a device that is about to show up, and slows down in
+ * steps the longer it runs, as the GAP's fast and slow connection
+ * establishment procedures do. The observer keeps the first step, it is
+ * there to hear every broadcast.
+ *
+ * Scans are passive. The uuid we connect to and the service data we observe
+ * are both in the advertising data, so scan requests would only cost air
+ * time, ours and the servers'.
+ *
+ * Where a window opens is up to the controller, and a connection event that
+ * falls due in it loses the radio. With a scan interval that is a multiple
+ * of a connection interval, the event that collided with one window would
+ * collide with every window after it, and the link would lose all its events
+ * at that phase until it times out. So while links are up, the interval is
+ * made a multiple of their shortest connection interval plus a shift of the
+ * window and SCAN_GUARD, the time an event takes. Every window then opens
+ * that much later against the anchors than the one before, and an event
+ * that one window took is clear of the next. The window is kept below half
+ * the connection interval, less the guard, so that it also stays clear when
+ * the shift wraps around. No link loses two events in a row to the scanner,
+ * and the windows sweep across the anchors instead of staying on one.
+ */
+
+#define SCAN_GUARD        4       // 2.5 ms, in units of 0.625 ms
+#define SCAN_WINDOW_MIN   0x0004
+#define SCAN_INTERVAL_MAX 0x4000
+
+struct scan_step {
+    u16_t interval;    // units of 0.625 ms
+    u16_t window;
+    u32_t duration_ms; // before the next step, 0 for the last one
+};
+
+static const struct scan_step scan_steps[] = {
+    { BT_GAP_SCAN_FAST_INTERVAL, BT_GAP_SCAN_FAST_WINDOW, 10000 },   // 60, 30 ms
+    { 0x0100, BT_GAP_SCAN_FAST_WINDOW, 30000 },                      // 160, 30 ms
+    { BT_GAP_SCAN_SLOW_INTERVAL_1, BT_GAP_SCAN_SLOW_WINDOW_1, 0 },   // 1.28 s, 11.25 ms
+};
+
+static int scan_step;  // of the scan for target
+static struct k_delayed_work scan_work;
+
+static void fit_scan_to_links(u16_t* interval, u16_t* window) {
+    u16_t shortest = 0;  // units of 0.625 ms
+
+    for(int i = 0; i < MAX_CONNECTIONS; i++) {
+        struct bt_conn_info info;
+
+        if(conns[i] && !bt_conn_get_info(conns[i], &info)) {
+            u16_t ci = info.le.interval * 2;  // units of 0.625 ms, as the scan parameters
+            if(!shortest || ci < shortest) {
+                shortest = ci;
+            }
+        }
+    }
+    if(!shortest) {
+        return;
+    }
+
+    u16_t room = shortest / 2 > SCAN_GUARD ? shortest / 2 - SCAN_GUARD : 0;
+    *window = MAX(MIN(*window, room), SCAN_WINDOW_MIN);
+
+    int shift = *window + SCAN_GUARD;
+    int periods = MAX(*interval - shift + shortest - 1, 0) / shortest;
+    if(periods * shortest + shift > SCAN_INTERVAL_MAX) {
+        periods = (SCAN_INTERVAL_MAX - shift) / shortest;
+    }
+    *interval = periods * shortest + shift;
+    *window = MIN(*window, *interval);
+}
+
+static int start_scan(void) {
+    bool decaying = target != -1 && !observer;
+    const struct scan_step* step = &scan_steps[decaying ? scan_step : 0];
+    struct bt_le_scan_param scan_param = {
+	.type       = BT_LE_SCAN_TYPE_PASSIVE,
+	.options    = BT_LE_SCAN_OPT_NONE,
+	.interval   = step->interval,
+	.window     = step->window,
+    };
+
+    fit_scan_to_links(&scan_param.interval, &scan_param.window);
+    bt_le_scan_stop();
+    int err = bt_le_scan_start(&scan_param, device_found);
+    if(!err && decaying && step->duration_ms) {
+        k_delayed_work_submit(&scan_work, K_MSEC(step->duration_ms));
+    }
+    return err;
+}
+
+static void slow_down_scan(struct k_work* work) {
+    // the device was found, or we stopped looking
+    if(target == -1 || conns[target_key]) {
+        return;
+    }
+
+    scan_step = MIN(scan_step + 1, ARRAY_SIZE(scan_steps) - 1);
+    if(start_scan()) {
+        printk("Scanning failed to slow down\n");
+    }
+}
+
+/*********** Reconnection ***********/
+/* Scanning for a uuid means waiting until the device advertises again and
+ * keeping the radio busy scanning meanwhile. Instead we remember the identity
+ * address of every peer we have been connected to, and a request to connect
+ * to a uuid first tries to connect directly to a known peer for that uuid.
+ * The controller then only listens for that one address.
+ *
+ * A direct attempt gives up after DIRECT_TIMEOUT_MS. Failed attempts are
+ * retried with exponential backoff plus a random jitter, so that many links
+ * that dropped together do not retry in lockstep. After DIRECT_ATTEMPTS
+ * failures in a row we fall back to scanning for the uuid.
+ *
+ * The controller initiates one connection at a time, so requests are queued
+ * and connect_work handles them one by one.
+ */
+
+#define DIRECT_TIMEOUT_MS 1000
+#define DIRECT_ATTEMPTS   3
+#define BACKOFF_BASE_MS   100
+#define BACKOFF_MAX_MS    5000
+
+struct peer {
+    bool valid;
+    int uuid;
+    bt_addr_le_t addr;
+    u8_t failures;     // failed direct attempts in a row
+    s64_t not_before;  // uptime in ms, do not retry before this
+};
+
+K_MUTEX_DEFINE(connect_lock);
+static struct peer peers[MAX_CONNECTIONS];
+static int requests[MAX_CONNECTIONS]; // uuids waiting to be connected
+static int n_requests;
+static bool connecting;               // a direct attempt or scan is running
+static int connecting_uuid;
+static struct peer* connecting_peer;  // NULL when scanning
+static struct k_delayed_work connect_work;
+
+static bool peer_connected(struct peer* p) {
+    struct bt_conn* conn = bt_conn_lookup_addr_le(BT_ID_DEFAULT, &p->addr);
+    if(conn) {
+        bt_conn_unref(conn);
+        return true;
+    }
+    return false;
+}
+
+/* Remember the peer, reusing an entry that is free or not connected */
+static void remember_peer(const bt_addr_le_t* addr, int uuid) {
+    struct peer* p = NULL;
+
+    for(int i = 0; i < MAX_CONNECTIONS; i++) {
+        if(peers[i].valid && !bt_addr_le_cmp(&peers[i].addr, addr)) {
+            p = &peers[i];
+            break;
+        }
+        if(!p && (!peers[i].valid || !peer_connected(&peers[i]))) {
+            p = &peers[i];
+        }
+    }
+    if(p) {
+        p->valid = true;
+        p->uuid = uuid;
+        bt_addr_le_copy(&p->addr, addr);
+        p->failures = 0;
+        p->not_before = 0;
+    }
+}
+
+static u32_t backoff_ms(u8_t failures) {
+    u32_t delay = MIN(BACKOFF_BASE_MS << failures, BACKOFF_MAX_MS);
+    return delay + sys_rand32_get() % (delay / 2 + 1);
+}
+
+/* Requeues a failed attempt in front. try_connect may have filled the queue
+ * while it ran, then the attempt is dropped as try_connect drops requests.
+ */
+static void push_request(int uuid) {
+    if(n_requests >= MAX_CONNECTIONS) {
+        printk("Dropping the retry of %04x, %d requests are waiting\n",
+               uuid, n_requests);
+        return;
+    }
+    for(int i = n_requests; i > 0; i--) {
+        requests[i] = requests[i - 1];
+    }
+    requests[0] = uuid;
+    n_requests++;
+}
+
+static int pop_request(void) {
+    int uuid = requests[0];
+    n_requests--;
+    for(int i = 0; i < n_requests; i++) {
+        requests[i] = requests[i + 1];
+    }
+    return uuid;
+}
+
+static int direct_connect(struct peer* p, int slot) {
+    struct bt_conn_le_create_param param =
+        BT_CONN_LE_CREATE_PARAM_INIT(BT_CONN_LE_OPT_NONE,
+                                     BT_GAP_SCAN_FAST_INTERVAL,
+                                     BT_GAP_SCAN_FAST_INTERVAL);
+    param.timeout = DIRECT_TIMEOUT_MS / 10;
+
+    if(observer) {
+        bt_le_scan_stop();
+    }
+    connect_started[slot] = k_uptime_get_32();
+    return bt_conn_le_create(&p->addr, &param, BT_LE_CONN_PARAM_DEFAULT, &conns[slot]);
+}
+
+static void connect_next(struct k_work* work) {
+    k_mutex_lock(&connect_lock, K_FOREVER);
+    if(connecting || !n_requests) {
+        k_mutex_unlock(&connect_lock);
+        return;
+    }
+
+    s64_t now = k_uptime_get();
+    s64_t wait = -1;
+    struct peer* p = NULL;
+
+    for(int i = 0; i < MAX_CONNECTIONS; i++) {
+        struct peer* candidate = &peers[i];
+        if(!candidate->valid || candidate->uuid != requests[0] ||
+           candidate->failures >= DIRECT_ATTEMPTS || peer_connected(candidate)) {
+            continue;
+        }
+        if(candidate->not_before <= now) {
+            p = candidate;
+            break;
+        }
+        if(wait < 0 || candidate->not_before - now < wait) {
+            wait = candidate->not_before - now;
+        }
+    }
+
+    if(!p && wait >= 0) {
+        // known peers are backing off, wait for the first one
+        k_delayed_work_submit(&connect_work, K_MSEC(wait));
+        k_mutex_unlock(&connect_lock);
+        return;
+    }
+
     int slot = get_slot();
-    if(slot != -1) {
-        int err; 
-        target = uuid_in_hex;
-        target_key = slot;
+    if(slot == -1) {
+        printk("Maximum number of concurrent connections reached: %d\n",
+			MAX_CONNECTIONS);
+        k_mutex_unlock(&connect_lock);
+        return;
+    }
 
-        struct bt_le_scan_param scan_param = {
-	    .type       = BT_LE_SCAN_TYPE_ACTIVE,
-	    .options    = BT_LE_SCAN_OPT_NONE,
-	    .interval   = BT_GAP_SCAN_FAST_INTERVAL,
-	    .window     = BT_GAP_SCAN_FAST_WINDOW,
-        };
+    int err;
+    connecting = true;
+    connecting_uuid = pop_request();
+    connecting_peer = p;
+    if(p) {
+        char addr[BT_ADDR_LE_STR_LEN];
+        bt_addr_le_to_str(&p->addr, addr, sizeof(addr));
+        printk("Connecting directly to %s (attempt %u)\n", addr, p->failures + 1);
 
-        err = bt_le_scan_start(&scan_param, device_found);
+        err = direct_connect(p, slot);
+        if(err) {
+            printk("Create conn failed (err %d)\n", err);
+        }
+    } else {
+        target = connecting_uuid;
+        target_key = slot;
+        scan_step = 0;
+
+        err = start_scan();
         if(err) {
             printk("Scanning failed to start (err %d)\n", err);
-    	    target = -1;
-    	    return;
+            target = -1;
+        } else {
+            printk("Scanning successfully started\n");
         }
-        printk("Scanning successfully started\n");
+    }
+
+    if(err) {
+        recycle_key(slot);
+        push_request(connecting_uuid);
+        connecting = false;
+        if(p) {
+            p->failures++;
+            p->not_before = now + backoff_ms(p->failures);
+        }
+        k_delayed_work_submit(&connect_work, K_MSEC(p ? 0 : BACKOFF_BASE_MS));
+    }
+    k_mutex_unlock(&connect_lock);
+}
+
+/* Called from the connection callback when an attempt has finished */
+static void connect_done(struct bt_conn* conn, u8_t conn_err) {
+    k_mutex_lock(&connect_lock, K_FOREVER);
+    if(!conn_err) {
+        remember_peer(bt_conn_get_dst(conn), connecting_uuid);
+    } else if(connecting_peer) {
+        connecting_peer->failures++;
+        connecting_peer->not_before = k_uptime_get() + backoff_ms(connecting_peer->failures);
+        push_request(connecting_uuid);
+    } else {
+        push_request(connecting_uuid);
+    }
+    connecting = false;
+    connecting_peer = NULL;
+    k_mutex_unlock(&connect_lock);
+
+    k_delayed_work_submit(&connect_work, K_NO_WAIT);
+}
+
+static void identity_resolved(struct bt_conn *conn, const bt_addr_le_t *rpa,
+			      const bt_addr_le_t *identity) {
+    k_mutex_lock(&connect_lock, K_FOREVER);
+    for(int i = 0; i < MAX_CONNECTIONS; i++) {
+        if(peers[i].valid && !bt_addr_le_cmp(&peers[i].addr, rpa)) {
+            bt_addr_le_copy(&peers[i].addr, identity);
+        }
+    }
+    k_mutex_unlock(&connect_lock);
+}
+
+void try_connect(int uuid_in_hex) {
+    k_mutex_lock(&connect_lock, K_FOREVER);
+    if(n_requests < MAX_CONNECTIONS) {
+        requests[n_requests++] = uuid_in_hex;
     } else {
         printk("Maximum number of concurrent connections reached: %d\n",
 			MAX_CONNECTIONS);
     }
+    k_mutex_unlock(&connect_lock);
+
+    k_delayed_work_submit(&connect_work, K_NO_WAIT);
+}
+/*********************************************/
+
+int observe_broadcasts(int uuid_in_hex, broadcast_cb cb) {
+    observed = uuid_in_hex;
+    observer = cb;
+
+    int err = start_scan();
+    if(err) {
+        printk("Observer failed to start scanning (err %d)\n", err);
+        observer = NULL;
+        return 1;
+    }
+    printk("Observing broadcasts of %04x\n", uuid_in_hex);
+    return 0;
+}
+
+void stop_observing() {
+    observer = NULL;
+    observed = -1;
+    if(target == -1) {
+        bt_le_scan_stop();
+    }
+}
+
+/* Connecting stopped the scanner, pick up observing again */
+static void resume_observer(void) {
+    if(observer && start_scan()) {
+        printk("Observer failed to restart scanning\n");
+    }
 }
 
 /* Connection callback */
@@ -514,23 +1239,46 @@ void unregister_connected_callback() { connect = NULL; };
 
 static void connected(struct bt_conn *conn, u8_t conn_err) {
 	char addr[BT_ADDR_LE_STR_LEN];
+	int key = get_key(conn);
+
+	if (key == -1) {
+		return;
+	}
 
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 
-	int key = get_key(conn);
-	struct conn* connection = (struct conn*)k_malloc(sizeof(struct conn));
-	connection->key = key;
-	apiconns[key] = connection;
 	if (conn_err) {
 		printk("Failed to connect to %s (%u)\n", addr, conn_err);
 
 		bt_conn_unref(conn);
 		recycle_key(key);
+		target = -1;
+		connect_done(conn, conn_err);
+		resume_observer();
 		return;
 	}
 
+	struct conn* connection = (struct conn*)k_malloc(sizeof(struct conn));
+	if (!connection) {
+		/* Without the API object the link is of no use. Count it
+		 * as a failed attempt, so the uuid is requeued, and drop
+		 * it. disconnected() releases the slot.
+		 */
+		printk("No memory for the connection to %s\n", addr);
+		target = -1;
+		target_key = -1;
+		connect_done(conn, BT_HCI_ERR_UNSPECIFIED);
+		bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+		resume_observer();
+		return;
+	}
+	connection->key = key;
+	apiconns[key] = connection;
+
 	printk("Connected: %s\n", addr);
 
+	secure_link(conn);
+
 	/* If a conn_cb is registered, apply it */
 	if(connect) {
             connect(connection);
@@ -538,7 +1286,8 @@ static void connected(struct bt_conn *conn, u8_t conn_err) {
 
 	target = -1;
 	target_key = -1;
-	t = NULL;
+	connect_done(conn, 0);
+	resume_observer();
 }
 
 conn_cb disconnect;
@@ -547,24 +1296,34 @@ void unregister_disconnected_callback() { disconnect = NULL; };
 
 static void disconnected(struct bt_conn *conn, u8_t reason) {
 	char addr[BT_ADDR_LE_STR_LEN];
+
+	if (get_key(conn) == -1) {
+		return;
+	}
+
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 	printk("Disconnected: %s (reason 0x%02x)\n", addr, reason);
 
 	bt_conn_unref(conn);
-	if(disconnect) {
-            int key = get_key(conn);
-	    struct conn* apiconn = apiconns[key];
+
+	int key = get_key(conn);
+	struct conn* apiconn = apiconns[key];
+
+	cancel_discovery(key);
+	// NULL if connected() could not allocate it
+	if(disconnect && apiconn) {
 	    disconnect(apiconn);
-	    recycle_key(key);
-	    k_free(apiconn);
-	    apiconns[key] = NULL;
 	}
-
+	recycle_key(key);
+	k_free(apiconn);
+	apiconns[key] = NULL;
 }
 
 static struct bt_conn_cb conn_callbacks = {
 	.connected = connected,
 	.disconnected = disconnected,
+	.identity_resolved = identity_resolved,
+	.security_changed = security_changed,
 };
 
 void start_bt(void)
@@ -572,11 +1331,20 @@ void start_bt(void)
 	int err;
 
 	stack = newStack(MAX_CONNECTIONS);
+	if (!stack) {
+		printk("No memory for the connection slots\n");
+		return;
+	}
         for(int i = 0; i < MAX_CONNECTIONS; i++) {
             push(stack, i);
 	}
 
-	t = (struct bt_uuid*) k_malloc(sizeof(struct bt_uuid));
+	k_delayed_work_init(&connect_work, connect_next);
+	k_delayed_work_init(&scan_work, slow_down_scan);
+	for(int i = 0; i < MAX_CONNECTIONS; i++) {
+	    discoveries[i].key = i;
+	    k_delayed_work_init(&discoveries[i].work, discovery_work);
+	}
 
 	err = bt_enable(NULL);
 
@@ -587,5 +1355,11 @@ void start_bt(void)
 
 	printk("Bluetooth initialized\n");
 
+	/* Restore bonds, must happen before we connect to anything */
+	if (IS_ENABLED(CONFIG_SETTINGS)) {
+		settings_load();
+	}
+
 	bt_conn_cb_register(&conn_callbacks);
+	link_stats_init();
 }
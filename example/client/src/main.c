@@ -1,6 +1,10 @@
 #include "api.h"
+#include "runtime.h"
+#include "wire.h"
+#include <string.h>
 #include <sys/printk.h>
 #include <zephyr.h>
+#include "heapstats.h"
 
 #define DEVICE                             0xffcc
 
@@ -11,108 +15,307 @@
 #define OCTAVIUS_CHARACTERISTIC            0xff22
 
 /********************/
-struct blexa_mem
-{ int l;
+int func(int temp, int door) {
+    int x;
+    /* Duplicate window commands are not forwarded */
+    if(runtime_step(temp, door, &x)) {
+        printk("temperature: %d octavius %d windowCommand %d\n",temp, door, x);
+    }
+    return 0;
+}
+/********************/
+
+/*********** Catch-up ***********/
+/* Samples carry sequence numbers, and a stream per peer and sensor remembers
+ * the last one that was stepped, across reconnects. Samples are only stepped
+ * in order, one that repeats is dropped. When a link to a peer we know comes
+ * back, we write History.Since to the characteristic and the server notifies
+ * the samples we missed from its history, in runs, so what it produced while
+ * the link was down is stepped too. Live samples that come after a gap
+ * during the catch-up are left to it. A catch-up that has not caught up
+ * within CATCH_UP_TIMEOUT_MS, e.g. on a saturated link, is given up, and
+ * from then on a gap counts as lost samples, as it does while connected.
+ *
+ * Everything here runs on the Bluetooth thread, apart from scanned_callback
+ * on the system work queue. That starts the catch-up before it subscribes,
+ * so no notification of the stream can come in while it does.
+ */
+#define CATCH_UP_TIMEOUT_MS 5000
+
+enum { TEMPERATURE, OCTAVIUS, SENSORS };
+
+struct stream {
+    bool known;          // last is the seq of a sample that was stepped
+    u32_t last;
+    struct value* val;   // NULL while the characteristic is not subscribed
+    bool catching_up;
+    u32_t catch_up_at;   // uptime of the Since
+    bool no_history;     // the server refused Since
+    u32_t lost;          // samples the server no longer had
+};
+
+struct peer {
+    bool used;
+    u8_t addr[6];
+    u32_t seen;          // uptime of the last connection
+    struct stream streams[SENSORS];
 };
 
-struct blexa_mem *main_mem;
+static struct peer peers[CONFIG_BT_MAX_CONN];
+static struct peer* peer_of_key[CONFIG_BT_MAX_CONN];
 
-void (blexa_reset(struct blexa_mem (* self))) {
-  ((*(self)).l) = (0);
+static bool connected_now(const struct peer* p) {
+    for(int i = 0; i < CONFIG_BT_MAX_CONN; i++) {
+        if(peer_of_key[i] == p) {
+            return true;
+        }
+    }
+    return false;
 }
 
-int (blexa_step(struct blexa_mem (* self), int a, int b)) {
-  int j;
-  int d;
-  int m;
-  int k;
-  int g;
-  int f;
-  int e;
-  int c;
-  int o;
-  int n;
-  int h;
-  switch (b) {
-    case (2): (j) = (2); break;
-    case (1): (j) = (1); break;
-    case (0): (j) = (0); break;
-  };
-  (f) = ((*(self)).l);
-  (d) = (j);
-  switch (d) {
-    case (2): (k) = (1); break;
-    case (1): (k) = (0); break;
-    case (0): (k) = (f); break;
-  };
-  (e) = (k);
-  switch (b) {
-    case (2): (m) = (1); break;
-    case (1): (m) = (0); break;
-    case (0): (m) = (e); break;
-  };
-  (g) = (m);
-  ((*(self)).l) = (e);
-  (c) = ((a) > (30));
-  switch (c) {
-    case (1): (n) = (1); break;
-    case (0): (n) = (0); break;
-  };
-  switch (g) {
-    case (1): (o) = (n); break;
-    case (0): (o) = (2); break;
-  };
-  (h) = (o);
-  return h;
+/* A peer we have not seen before takes the place of the one seen longest
+ * ago, and starts without history
+ */
+static struct peer* find_peer(const u8_t addr[6]) {
+    struct peer* replace = NULL;
+
+    for(int i = 0; i < CONFIG_BT_MAX_CONN; i++) {
+        struct peer* p = &peers[i];
+
+        if(p->used && !memcmp(p->addr, addr, sizeof(p->addr))) {
+            return p;
+        }
+        if(!connected_now(p) && (!replace || !p->used ||
+                                 (replace->used && p->seen < replace->seen))) {
+            replace = p;
+        }
+    }
+
+    if(replace) {
+        memset(replace, 0, sizeof(*replace));
+        replace->used = true;
+        memcpy(replace->addr, addr, sizeof(replace->addr));
+    }
+    return replace;
 }
 
-int func(int temp, int door) {
-    int x = blexa_step(main_mem, temp, door);
-    printk("temperature: %d octavius %d windowCommand %d\n",temp, door, x);
-    return 0;
+static struct stream* stream_of(struct value* val) {
+    struct peer* p = peer_of_key[val->conn_key];
+
+    if(!p) {
+        return NULL;
+    }
+    return &p->streams[val->characteristic_uuid == OCTAVIUS_CHARACTERISTIC];
 }
-/********************/
 
-void subscribe_temperature(const void* buf, int len) {
-    int* input = (int*) buf;
-    func(*input, 0);
+static void since_written(struct value* val, int err) {
+    struct stream* s = stream_of(val);
+
+    if(s && err) {
+        printk("Catch-up refused (err %d)\n", err);
+        s->catching_up = false;
+        s->no_history = true;
+    }
 }
 
-void subscribe_octavius(const void* buf, int len) {
-    int* input = (int*) buf;
-    func(-273, (*input) + 1);
+static void catch_up(struct stream* s) {
+    struct wire_history h = { .tag = WIRE_HISTORY_SINCE };
+    u8_t buf[WRITE_MAX];
+    int len;
+
+    if(!s->val || s->no_history) {
+        return;
+    }
+
+    h.since.seq = s->last;
+    len = wire_encode_history(&h, buf, sizeof(buf));
+    s->catching_up = len > 0 && !write_characteristic(s->val, buf, len, since_written);
+    s->catch_up_at = k_uptime_get_32();
 }
 
-void scanned_temperature_callback(struct value* val) {
-    subscribe_characteristic(val, subscribe_temperature);
+/* Returns whether the sample with sequence number seq is to be stepped: it
+ * is the next one of the stream, or comes after samples that will not be
+ * caught up with any more
+ */
+static bool in_order(struct stream* s, u32_t seq, bool replayed) {
+    if(!s || !seq) {
+        // nothing to order by
+        return true;
+    }
+    if(s->known && seq <= s->last) {
+        return false;
+    }
+    if(s->known && seq != s->last + 1) {
+        if(s->catching_up && !replayed) {
+            if(k_uptime_get_32() - s->catch_up_at < CATCH_UP_TIMEOUT_MS) {
+                return false;
+            }
+            printk("Catch-up timed out at %u\n", s->last);
+            s->catching_up = false;
+        }
+        s->lost += seq - s->last - 1;
+        printk("Lost %u samples before %u\n", seq - s->last - 1, seq);
+    }
+    s->known = true;
+    s->last = seq;
+    return true;
 }
 
-void scanned_octavius_callback(struct value* val) {
-    subscribe_characteristic(val, subscribe_octavius);
+static void step_sample(struct stream* s, const struct wire_sample* sample, bool replayed) {
+    switch(sample->tag) {
+    case WIRE_SAMPLE_TEMPERATURE:
+        if(in_order(s, sample->temperature.seq, replayed)) {
+            func(sample->temperature.value, 0);
+        }
+        break;
+    case WIRE_SAMPLE_OCTAVIUS:
+        if(in_order(s, sample->octavius.seq, replayed)) {
+            func(-273, sample->octavius.open + 1);
+        }
+        break;
+    }
+}
+
+/* The samples of a run are stepped in order, as if they had been notified */
+static void replay(struct stream* s, const struct wire_history* h) {
+    const u8_t* p = h->run.samples.data;
+    u16_t left = h->run.samples.len;
+
+    if(s && s->known && h->run.newest < s->last) {
+        printk("Server restarted, its samples start over\n");
+        s->known = false;
+    }
+
+    while(left) {
+        struct wire_sample sample;
+        int len = wire_decode_sample(p, left, &sample);
+
+        if(len < 0) {
+            printk("Malformed sample in run\n");
+            break;
+        }
+        step_sample(s, &sample, true);
+        p += len;
+        left -= len;
+    }
+
+    if(s && (!h->run.samples.len || s->last >= h->run.newest)) {
+        printk("Caught up to %u, %u ms behind\n", h->run.newest, h->run.age);
+        s->catching_up = false;
+    }
+}
+
+/* Both characteristics carry a struct wire_sample, the tag tells them apart.
+ * During a catch-up they carry struct wire_history runs as well.
+ */
+void sample_received(struct value* val, const void* buf, int len) {
+    struct stream* s = stream_of(val);
+    struct wire_sample sample;
+    struct wire_history h;
+
+    if(wire_decode_sample(buf, len, &sample) >= 0) {
+        step_sample(s, &sample, false);
+    } else if(wire_decode_history(buf, len, &h) >= 0 && h.tag == WIRE_HISTORY_RUN) {
+        replay(s, &h);
+    } else {
+        printk("Malformed sample notification (len %d)\n", len);
+    }
+}
+
+/* Observer mode: the server publishes both values in its advertising. Every
+ * advertising event repeats the data, the version tells us when it changed.
+ * Only the values that changed are stepped, as if they had been notified.
+ */
+static bool broadcast_seen;
+static struct wire_broadcast last_broadcast;
+
+void broadcast_received(const void* buf, int len) {
+    struct wire_broadcast b;
+
+    if(wire_decode_broadcast(buf, len, &b) < 0 || b.tag != WIRE_BROADCAST_SAMPLES) {
+        printk("Malformed broadcast (len %d)\n", len);
+        return;
+    }
+
+    if(broadcast_seen && b.samples.version == last_broadcast.samples.version) {
+        return;
+    }
+
+    if(!broadcast_seen || b.samples.temperature != last_broadcast.samples.temperature) {
+        func(b.samples.temperature, 0);
+    }
+    if(!broadcast_seen || b.samples.octavius != last_broadcast.samples.octavius) {
+        func(-273, b.samples.octavius + 1);
+    }
+
+    last_broadcast = b;
+    broadcast_seen = true;
+}
+
+void scanned_callback(struct value* val) {
+    struct stream* s = stream_of(val);
+
+    if(s) {
+        s->val = val;
+        if(s->known) {
+            catch_up(s);
+        }
+    }
+    subscribe_characteristic_value(val, sample_received);
 }
 
 void connected(struct conn* id) {
+    u8_t addr[6];
+    struct peer* p = NULL;
+
+    if(!get_peer_address(id, addr)) {
+        p = find_peer(addr);
+    }
+    if(p) {
+        p->seen = k_uptime_get_32();
+        for(int i = 0; i < SENSORS; i++) {
+            p->streams[i].val = NULL;
+            p->streams[i].catching_up = false;
+            p->streams[i].no_history = false;
+        }
+    }
+    peer_of_key[id->key] = p;
+
     scan_for_characteristic(id,
 		            OCTAVIUS_SERVICE, 
 			    OCTAVIUS_CHARACTERISTIC, 
-			    scanned_octavius_callback);
+			    scanned_callback);
     scan_for_characteristic(id,
 		            TEMPERATURE_SENSOR_SERVICE, 
 			    TEMPERATURE_SENSOR_CHARACTERISTIC, 
-			    scanned_temperature_callback);
+			    scanned_callback);
 }
 
+/* Runs on the Bluetooth thread, it must not block */
 void disconnected(struct conn* id) {
+    peer_of_key[id->key] = NULL;
     try_connect(DEVICE);
 }
 
 void main() {
-    main_mem = (struct blexa_mem*) k_malloc (sizeof(struct blexa_mem));
-    blexa_reset(main_mem);
+    runtime_init();
 
     start_bt();
-    register_connected_callback(connected);
-    register_disconnected_callback(disconnected);
-    try_connect(DEVICE);
+
+    if(IS_ENABLED(CONFIG_APP_OBSERVER)) {
+        observe_broadcasts(DEVICE, broadcast_received);
+    } else {
+        register_connected_callback(connected);
+        register_disconnected_callback(disconnected);
+        try_connect(DEVICE);
+    }
+
+    while (1) {
+        k_sleep(K_SECONDS(30));
+        runtime_print_stats();
+        if(IS_ENABLED(CONFIG_APP_HEAP_TRACK)) {
+            heap_track_print(HEAP_TRACK_TOP);
+        }
+    }
 }
 
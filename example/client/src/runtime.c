@@ -0,0 +1,79 @@
+#include "runtime.h"
+#include "blexa.h"
+
+#include <string.h>
+#include <zephyr.h>
+#include <sys/printk.h>
+
+/* Number of memo entries, must be a power of two. The example alternates
+ * between temperature and octavius notifications, so a single entry would
+ * be evicted on every step.
+ */
+#define MEMO_ENTRIES 4
+
+struct memo {
+    bool valid;
+    int a;
+    int b;
+    int out;
+    struct blexa_mem before;
+    struct blexa_mem after;
+};
+
+/* Only ever stepped from the Bluetooth receive thread, so no locking. */
+static struct blexa_mem mem;
+static struct memo memo[MEMO_ENTRIES];
+static struct runtime_stats stats;
+
+static bool has_output;
+static int last_output;
+
+static struct memo* memo_slot(int a, int b) {
+    u32_t h = (u32_t)a * 31U + (u32_t)b;
+    return &memo[h & (MEMO_ENTRIES - 1)];
+}
+
+void runtime_init(void) {
+    blexa_reset(&mem);
+    memset(memo, 0, sizeof(memo));
+    memset(&stats, 0, sizeof(stats));
+    has_output = false;
+}
+
+int runtime_step(int a, int b, int* out) {
+    struct memo* m = memo_slot(a, b);
+
+    stats.steps++;
+    if(m->valid && m->a == a && m->b == b &&
+       !memcmp(&m->before, &mem, sizeof(mem))) {
+        mem = m->after;
+        *out = m->out;
+        stats.elided++;
+    } else {
+        m->before = mem;
+        m->a = a;
+        m->b = b;
+        m->out = blexa_step(&mem, a, b);
+        m->after = mem;
+        m->valid = true;
+        *out = m->out;
+        stats.evaluated++;
+    }
+
+    if(has_output && last_output == *out) {
+        stats.suppressed++;
+        return 0;
+    }
+    has_output = true;
+    last_output = *out;
+    return 1;
+}
+
+void runtime_get_stats(struct runtime_stats* s) {
+    *s = stats;
+}
+
+void runtime_print_stats(void) {
+    printk("[RUNTIME] steps %u evaluated %u elided %u suppressed %u\n",
+           stats.steps, stats.evaluated, stats.elided, stats.suppressed);
+}
@@ -0,0 +1,37 @@
+#ifndef RUNTIME_BLE
+#define RUNTIME_BLE
+
+#include <zephyr/types.h>
+
+/* Step runtime for the generated synchronous program (blexa_step).
+ *
+ * The server re-sends unchanged values every second, so most steps are taken
+ * with inputs we have already seen, from a state we have already been in.
+ * The step function is deterministic, meaning that the same state and inputs
+ * always produce the same output and the same next state. The runtime keeps a
+ * small memo of (state, inputs) -> (next state, output) and skips evaluation
+ * when it finds a match.
+ *
+ * Outputs that are equal to the previously emitted output are reported as
+ * duplicates so that downstream consumers can ignore them.
+ */
+
+struct runtime_stats {
+    u32_t steps;      // calls to runtime_step
+    u32_t evaluated;  // steps where blexa_step actually ran
+    u32_t elided;     // steps answered from the memo
+    u32_t suppressed; // outputs equal to the previous output
+};
+
+void runtime_init(void);
+
+/* Advance the program one step. The output is written to *out. Returns 1 if
+ * the output differs from the previous output (or is the first one), and 0 if
+ * it is a duplicate that should not be forwarded.
+ */
+int runtime_step(int a, int b, int* out);
+
+void runtime_get_stats(struct runtime_stats* stats);
+void runtime_print_stats(void);
+
+#endif
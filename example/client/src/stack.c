@@ -2,15 +2,24 @@
 #include "stack.h"
 
 #include <zephyr.h>
+#include "heapstats.h"
 
 // stack for positive integers
 
+// NULL if the heap is exhausted
 struct stack* newStack(int capacity) {
     struct stack *pt = (struct stack*)k_malloc(sizeof(struct stack));
+    if (!pt) {
+        return NULL;
+    }
 
     pt->maxsize = capacity;
     pt->top = -1;
     pt->items = (int*)k_malloc(sizeof(int) * capacity);
+    if (!pt->items) {
+        k_free(pt);
+        return NULL;
+    }
 
     return pt;
 }
@@ -0,0 +1,163 @@
+#include "heapstats.h"
+
+#include <zephyr.h>
+#include <string.h>
+#include <sys/printk.h>
+#include <shell/shell.h>
+
+#if defined(CONFIG_APP_HEAP_TRACK)
+
+K_MUTEX_DEFINE(heap_track_lock);
+static struct heap_site* sites;
+static u32_t total_live_bytes;
+static u32_t total_live_blocks;
+static u32_t total_peak_bytes;
+
+/* The names in parentheses are the kernel's k_malloc and k_free, not the
+ * macros of heapstats.h
+ */
+void* heap_track_malloc(struct heap_site* site, size_t size) {
+    struct heap_block* block = (k_malloc)(sizeof(struct heap_block) + size);
+
+    k_mutex_lock(&heap_track_lock, K_FOREVER);
+    if(!site->listed) {
+        site->listed = true;
+        site->next = sites;
+        sites = site;
+    }
+    site->allocs++;
+    if(!block) {
+        site->failures++;
+        k_mutex_unlock(&heap_track_lock);
+        return NULL;
+    }
+    site->live_blocks++;
+    site->live_bytes += size;
+    site->peak_bytes = MAX(site->peak_bytes, site->live_bytes);
+    total_live_blocks++;
+    total_live_bytes += size;
+    total_peak_bytes = MAX(total_peak_bytes, total_live_bytes);
+    k_mutex_unlock(&heap_track_lock);
+
+    block->site = site;
+    block->size = size;
+    block->allocated_at = k_uptime_get_32();
+    return block + 1;
+}
+
+void heap_track_free(void* ptr) {
+    struct heap_block* block = (struct heap_block*)ptr - 1;
+    struct heap_site* site;
+    u32_t lifetime;
+
+    if(!ptr) {
+        return;
+    }
+
+    site = block->site;
+    lifetime = k_uptime_get_32() - block->allocated_at;
+
+    k_mutex_lock(&heap_track_lock, K_FOREVER);
+    site->frees++;
+    site->live_blocks--;
+    site->live_bytes -= block->size;
+    site->lifetime_total_ms += lifetime;
+    site->lifetime_max_ms = MAX(site->lifetime_max_ms, lifetime);
+    total_live_blocks--;
+    total_live_bytes -= block->size;
+    k_mutex_unlock(&heap_track_lock);
+
+    (k_free)(block);
+}
+
+static bool ranks_before(const struct heap_site* a, const struct heap_site* b) {
+    if(a->live_bytes != b->live_bytes) {
+        return a->live_bytes > b->live_bytes;
+    }
+    return a->peak_bytes > b->peak_bytes;
+}
+
+int heap_track_top(struct heap_site* top, int n) {
+    int count = 0;
+
+    k_mutex_lock(&heap_track_lock, K_FOREVER);
+    for(struct heap_site* s = sites; s; s = s->next) {
+        int i = count < n ? count++ : n;
+
+        // insertion into the sorted top, dropping the last one when full
+        while(i > 0 && ranks_before(s, &top[i - 1])) {
+            if(i < n) {
+                top[i] = top[i - 1];
+            }
+            i--;
+        }
+        if(i < n) {
+            top[i] = *s;
+        }
+    }
+    k_mutex_unlock(&heap_track_lock);
+    return count;
+}
+
+void heap_track_totals(u32_t* live_bytes, u32_t* live_blocks, u32_t* peak_bytes) {
+    k_mutex_lock(&heap_track_lock, K_FOREVER);
+    *live_bytes = total_live_bytes;
+    *live_blocks = total_live_blocks;
+    *peak_bytes = total_peak_bytes;
+    k_mutex_unlock(&heap_track_lock);
+}
+
+/* __FILE__ may be a full path */
+static const char* file_name(const char* file) {
+    const char* slash = strrchr(file, '/');
+    return slash ? slash + 1 : file;
+}
+
+/* not above lifetime_max_ms, so it fits */
+static u32_t lifetime_mean_ms(const struct heap_site* s) {
+    return s->frees ? (u32_t)(s->lifetime_total_ms / s->frees) : 0;
+}
+
+#define SITE_HEADER "        site      live  peak blocks allocs  frees fails  life avg/max ms"
+#define SITE_FORMAT "%12s:%-5u %5u %5u %6u %6u %6u %5u  %u/%u"
+#define SITE_ARGS(s) file_name((s)->file), (s)->line, (s)->live_bytes, (s)->peak_bytes, \
+    (s)->live_blocks, (s)->allocs, (s)->frees, (s)->failures, lifetime_mean_ms(s), \
+    (s)->lifetime_max_ms
+
+void heap_track_print(int n) {
+    struct heap_site top[HEAP_TRACK_TOP];
+    u32_t live_bytes, live_blocks, peak_bytes;
+    int count = heap_track_top(top, MIN(n, HEAP_TRACK_TOP));
+
+    heap_track_totals(&live_bytes, &live_blocks, &peak_bytes);
+    printk("heap: %u bytes live in %u blocks, peak %u, %u bytes of tracking\n",
+           live_bytes, live_blocks, peak_bytes,
+           live_blocks * (u32_t)HEAP_TRACK_OVERHEAD);
+    printk(SITE_HEADER "\n");
+    for(int i = 0; i < count; i++) {
+        printk(SITE_FORMAT "\n", SITE_ARGS(&top[i]));
+    }
+}
+
+/*********** Shell command ***********/
+#if defined(CONFIG_SHELL)
+static int cmd_heap(const struct shell* shell, size_t argc, char** argv) {
+    struct heap_site top[HEAP_TRACK_TOP];
+    u32_t live_bytes, live_blocks, peak_bytes;
+    int count = heap_track_top(top, HEAP_TRACK_TOP);
+
+    heap_track_totals(&live_bytes, &live_blocks, &peak_bytes);
+    shell_print(shell, "%u bytes live in %u blocks, peak %u, %u bytes of tracking",
+                live_bytes, live_blocks, peak_bytes,
+                live_blocks * (u32_t)HEAP_TRACK_OVERHEAD);
+    shell_print(shell, SITE_HEADER);
+    for(int i = 0; i < count; i++) {
+        shell_print(shell, SITE_FORMAT, SITE_ARGS(&top[i]));
+    }
+    return 0;
+}
+
+SHELL_CMD_REGISTER(heap, NULL, "Print the heap call sites with the most live bytes", cmd_heap);
+#endif
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef HEAPSTATS_BLE
+#define HEAPSTATS_BLE
+
+#include <zephyr.h>
+
+/* Per call site heap accounting.
+ *
+ * With CONFIG_APP_HEAP_TRACK every k_malloc and k_free in a file that
+ * includes this header goes through heap_track_malloc and heap_track_free.
+ * Include it after all other headers, the macros replace the names.
+ *
+ * Every call site of k_malloc owns a static struct heap_site, which is put
+ * on a list the first time it allocates. A block carries a header with its
+ * site, its size and when it was allocated, so k_free accounts it to the
+ * site that allocated it and records how long it lived. That costs
+ * HEAP_TRACK_OVERHEAD bytes of heap per live block, raise
+ * CONFIG_HEAP_MEM_POOL_SIZE accordingly. The bookkeeping is a handful of
+ * additions under a lock, cheap enough to stay enabled in soak tests.
+ *
+ * Blocks that are still live after every link has gone down are leaks, the
+ * report lists the sites with the most live bytes first. It is printed by the
+ * 'heap' shell command and by heap_track_print(), e.g. on host builds.
+ */
+
+struct heap_site {
+    const char* file;
+    u16_t line;
+    bool listed;
+    u32_t allocs;
+    u32_t frees;
+    u32_t failures;           // k_malloc returned NULL
+    u32_t live_blocks;
+    u32_t live_bytes;
+    u32_t peak_bytes;
+    u64_t lifetime_total_ms;  // of the blocks that were freed
+    u32_t lifetime_max_ms;
+    struct heap_site* next;
+};
+
+struct heap_block {
+    struct heap_site* site;
+    u32_t size;
+    u32_t allocated_at;       // uptime in ms
+} __aligned(8);
+
+#define HEAP_TRACK_OVERHEAD sizeof(struct heap_block)
+
+// sites in the report
+#define HEAP_TRACK_TOP 8
+
+void* heap_track_malloc(struct heap_site* site, size_t size);
+void heap_track_free(void* ptr);
+
+/* Copies up to n sites into sites, the most live bytes first, ties broken by
+ * the peak. Returns the number of sites copied.
+ */
+int heap_track_top(struct heap_site* sites, int n);
+
+/* Bytes and blocks live over all sites, and the peak of the live bytes */
+void heap_track_totals(u32_t* live_bytes, u32_t* live_blocks, u32_t* peak_bytes);
+
+/* printk()s the totals and the top n sites */
+void heap_track_print(int n);
+
+#if defined(CONFIG_APP_HEAP_TRACK)
+#define k_malloc(size) ({ \
+    static struct heap_site _heap_site = { .file = __FILE__, .line = __LINE__ }; \
+    heap_track_malloc(&_heap_site, (size)); })
+#define k_free(ptr) heap_track_free(ptr)
+#endif
+
+#endif
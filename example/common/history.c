@@ -0,0 +1,29 @@
+#include "history.h"
+
+#include <zephyr.h>
+#include <errno.h>
+
+/* The atomic operations are full barriers, see valuestore.c */
+
+void history_record(struct history* h, u32_t seq, s32_t value) {
+    struct history_entry* e = &h->entries[seq % h->size];
+
+    atomic_set(&e->seq, 0);
+    e->time = k_uptime_get_32();
+    e->value = value;
+    atomic_set(&e->seq, seq);
+}
+
+int history_get(struct history* h, u32_t seq, u32_t* time, s32_t* value) {
+    struct history_entry* e = &h->entries[seq % h->size];
+
+    if(!seq || (u32_t)atomic_get(&e->seq) != seq) {
+        return -ENOENT;
+    }
+    *time = e->time;
+    *value = e->value;
+    if((u32_t)atomic_get(&e->seq) != seq) {
+        return -ENOENT;
+    }
+    return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef HISTORY_BLE
+#define HISTORY_BLE
+
+#include <zephyr.h>
+#include <sys/atomic.h>
+
+/* A ring of the last samples of a value, each with the time it was taken.
+ *
+ * Samples are numbered by the writer, consecutively from 1, e.g. with the
+ * version of their struct value_slot. The sample with sequence number seq is
+ * kept in entry seq % size until it is overwritten size samples later.
+ *
+ * There is one writer. Like the value store it takes no lock: an entry is
+ * marked empty while it is written, and a reader that finds a different
+ * sequence number in the entry after copying it knows that it was
+ * overwritten in the meantime.
+ */
+
+struct history_entry {
+    atomic_t seq;    // 0 while empty or being written
+    u32_t time;      // uptime in ms
+    s32_t value;
+};
+
+struct history {
+    struct history_entry* entries;
+    u16_t size;
+};
+
+void history_record(struct history* h, u32_t seq, s32_t value);
+
+/* Copies the sample seq. Returns 0, or -ENOENT when it is not in the ring
+ * (any more).
+ */
+int history_get(struct history* h, u32_t seq, u32_t* time, s32_t* value);
+
+/* The oldest sequence number the ring can still hold when newest is the
+ * latest one written
+ */
+static inline u32_t history_oldest(const struct history* h, u32_t newest) {
+    return newest >= h->size ? newest - h->size + 1 : 1;
+}
+
+#endif
@@ -0,0 +1,135 @@
+#include "linkstats.h"
+
+#include <zephyr.h>
+#include <sys/printk.h>
+#include <sys/byteorder.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/gatt.h>
+#include <shell/shell.h>
+
+struct link_stats link_stats[CONFIG_BT_MAX_CONN];
+
+#define LINK_STATS_RECORD_SIZE (8 + 9 * sizeof(u32_t))
+
+u32_t link_stats_conn_events(const struct link_stats* s) {
+    if(!s->connected_at || !s->interval) {
+        return 0;
+    }
+    // interval is in units of 1.25 ms, the product overflows u32 after
+    // about 12 days connected
+    return (u64_t)(k_uptime_get_32() - s->connected_at) * 4U / (s->interval * 5U);
+}
+
+static void update_interval(struct bt_conn* conn) {
+    struct bt_conn_info info;
+
+    if(!bt_conn_get_info(conn, &info)) {
+        link_stats_of(conn)->interval = info.le.interval;
+    }
+}
+
+static void connected(struct bt_conn* conn, u8_t err) {
+    struct link_stats* s = link_stats_of(conn);
+    const bt_addr_le_t* peer = bt_conn_get_dst(conn);
+
+    if(err) {
+        return;
+    }
+
+    if(atomic_get(&s->connections) && !bt_addr_le_cmp(&s->peer, peer)) {
+        atomic_inc(&s->reconnects);
+    } else {
+        // a new peer in this slot
+        memset(s, 0, sizeof(*s));
+        bt_addr_le_copy(&s->peer, peer);
+    }
+    atomic_inc(&s->connections);
+    s->connected_at = k_uptime_get_32();
+    update_interval(conn);
+}
+
+static void disconnected(struct bt_conn* conn, u8_t reason) {
+    link_stats_of(conn)->connected_at = 0;
+}
+
+static void le_param_updated(struct bt_conn* conn, u16_t interval,
+                             u16_t latency, u16_t timeout) {
+    link_stats_of(conn)->interval = interval;
+}
+
+static struct bt_conn_cb link_stats_callbacks = {
+    .connected = connected,
+    .disconnected = disconnected,
+    .le_param_updated = le_param_updated,
+};
+
+void link_stats_init(void) {
+    bt_conn_cb_register(&link_stats_callbacks);
+}
+
+/*********** GATT characteristic ***********/
+static ssize_t read_link_stats(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                               void* buf, u16_t len, u16_t offset) {
+    u8_t value[CONFIG_BT_MAX_CONN * LINK_STATS_RECORD_SIZE];
+    u8_t* p = value;
+
+    for(int i = 0; i < CONFIG_BT_MAX_CONN; i++) {
+        struct link_stats* s = &link_stats[i];
+        u32_t counters[] = {
+            atomic_get(&s->notify_tx), atomic_get(&s->notify_rx),
+            atomic_get(&s->bytes_tx), atomic_get(&s->bytes_rx),
+            atomic_get(&s->att_errors), atomic_get(&s->drops),
+            link_stats_conn_events(s),
+            atomic_get(&s->connections), atomic_get(&s->reconnects),
+        };
+
+        if(!counters[7]) {
+            continue;
+        }
+        *p++ = i;
+        *p++ = s->peer.type;
+        memcpy(p, s->peer.a.val, sizeof(s->peer.a.val));
+        p += sizeof(s->peer.a.val);
+        for(int j = 0; j < ARRAY_SIZE(counters); j++) {
+            sys_put_le32(counters[j], p);
+            p += sizeof(u32_t);
+        }
+    }
+
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, value, p - value);
+}
+
+BT_GATT_SERVICE_DEFINE(link_stats_svc,
+    BT_GATT_PRIMARY_SERVICE(BT_UUID_LINK_STATS_SERVICE),
+    BT_GATT_CHARACTERISTIC(BT_UUID_LINK_STATS_CHARACTERISTIC,
+                           BT_GATT_CHRC_READ,
+                           BT_GATT_PERM_READ, read_link_stats, NULL, NULL),
+);
+
+/*********** Shell command ***********/
+#if defined(CONFIG_SHELL)
+static int cmd_stats(const struct shell* shell, size_t argc, char** argv) {
+    for(int i = 0; i < CONFIG_BT_MAX_CONN; i++) {
+        struct link_stats* s = &link_stats[i];
+        char addr[BT_ADDR_LE_STR_LEN];
+
+        if(!atomic_get(&s->connections)) {
+            continue;
+        }
+        bt_addr_le_to_str(&s->peer, addr, sizeof(addr));
+        shell_print(shell, "[%d] %s %s interval %u", i, addr,
+                    s->connected_at ? "connected" : "disconnected", s->interval);
+        shell_print(shell, "    notify tx %d (%d bytes) rx %d (%d bytes)",
+                    atomic_get(&s->notify_tx), atomic_get(&s->bytes_tx),
+                    atomic_get(&s->notify_rx), atomic_get(&s->bytes_rx));
+        shell_print(shell, "    att errors %d drops %d conn events %u connections %d reconnects %d",
+                    atomic_get(&s->att_errors), atomic_get(&s->drops),
+                    link_stats_conn_events(s), atomic_get(&s->connections),
+                    atomic_get(&s->reconnects));
+    }
+    return 0;
+}
+
+SHELL_CMD_REGISTER(stats, NULL, "Print per-connection link statistics", cmd_stats);
+#endif
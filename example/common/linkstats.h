@@ -0,0 +1,83 @@
+#ifndef LINKSTATS_BLE
+#define LINKSTATS_BLE
+
+#include <zephyr.h>
+#include <sys/atomic.h>
+#include <bluetooth/conn.h>
+
+/* Per-connection link statistics.
+ *
+ * There is one struct link_stats per connection object the stack can hold,
+ * indexed by bt_conn_index(). The counters are only ever touched with atomic
+ * operations, so the data path never takes a lock. The counters a slot
+ * carries survive reconnects of the same peer and are cleared when another
+ * peer takes over the slot.
+ *
+ * The statistics are exposed as a readable GATT characteristic and through
+ * the 'stats' shell command (make shell). The characteristic holds one
+ * record per connection slot that has been used, all fields little endian:
+ *
+ *   u8 slot, u8 address type, 6 byte address,
+ *   u32 notify_tx, notify_rx, bytes_tx, bytes_rx, att_errors, drops,
+ *       conn_events, connections, reconnects
+ */
+
+#define BT_UUID_LINK_STATS_SERVICE         BT_UUID_DECLARE_16(0xff31)
+#define BT_UUID_LINK_STATS_CHARACTERISTIC  BT_UUID_DECLARE_16(0xff32)
+
+/* The data path counters are kept together at the start of the struct, and
+ * every struct starts on its own line so slots do not share lines.
+ */
+#define LINK_STATS_ALIGN 32
+
+struct link_stats {
+    /* data path */
+    atomic_t notify_tx;
+    atomic_t notify_rx;
+    atomic_t bytes_tx;
+    atomic_t bytes_rx;
+    atomic_t att_errors;
+    atomic_t drops;
+    /* link changes */
+    atomic_t connections;
+    atomic_t reconnects;
+    bt_addr_le_t peer;
+    u16_t interval;      // connection interval in units of 1.25 ms
+    u32_t connected_at;  // uptime in ms when the link came up, 0 when down
+} __aligned(LINK_STATS_ALIGN);
+
+extern struct link_stats link_stats[CONFIG_BT_MAX_CONN];
+
+static inline struct link_stats* link_stats_of(struct bt_conn* conn) {
+    return &link_stats[bt_conn_index(conn)];
+}
+
+static inline void link_stats_tx(struct bt_conn* conn, u16_t len) {
+    struct link_stats* s = link_stats_of(conn);
+    atomic_inc(&s->notify_tx);
+    atomic_add(&s->bytes_tx, len);
+}
+
+static inline void link_stats_rx(struct bt_conn* conn, u16_t len) {
+    struct link_stats* s = link_stats_of(conn);
+    atomic_inc(&s->notify_rx);
+    atomic_add(&s->bytes_rx, len);
+}
+
+static inline void link_stats_error(struct bt_conn* conn) {
+    atomic_inc(&link_stats_of(conn)->att_errors);
+}
+
+static inline void link_stats_drop(struct bt_conn* conn) {
+    atomic_inc(&link_stats_of(conn)->drops);
+}
+
+/* The host does not see connection events, they are estimated from the
+ * time the link has been up and the connection interval.
+ */
+u32_t link_stats_conn_events(const struct link_stats* s);
+
+/* Registers the connection callbacks that track links coming and going */
+void link_stats_init(void);
+
+#endif
@@ -0,0 +1,462 @@
+#ifndef LUSTRE_BLE
+#define LUSTRE_BLE
+
+/* Lustre streams as C++17 templates, the combinators of Lustre.hs.
+ *
+ *   Lustre.hs              here
+ *   con x                  con(x), or a plain value where a stream is expected
+ *   pre xs                 pre(xs)
+ *   xs |-> ys              arrow(xs, ys), or xs ->* ys
+ *   ifThenElse c xs ys     ifThenElse(c, xs, ys)
+ *   f # xs                 map(f, xs)
+ *   f # xs ¤ ys ¤ zs       map(f, xs, ys, zs), or ap(ap(map(f, xs), ys), zs)
+ *   Num, .&&, .||, nott    the C++ operators, lifted to streams
+ *
+ * The inputs of the program are input<T, N>(), the Nth argument of step.
+ *
+ * A stream is a node: a value type that holds its operands, and
+ * with them the whole expression, in its type. Evaluating one tick is a call
+ * to step(), which the compiler inlines into one function, there are no
+ * virtual calls and nothing is allocated. The memory of a node is its
+ * nested struct state, made up of the states of its operands and what the
+ * node keeps itself: the last value for pre, the first tick flag for arrow.
+ * Nodes without memory have empty states that take no space, so the state
+ * of a program is one flat, trivially copyable struct, as blexa_mem is.
+ *
+ * As in Lustre every stream is evaluated at every tick, also the branch of
+ * ifThenElse that is not taken, so that the pre()s in it keep up. Pure
+ * branches are folded by the compiler, the choice is a select.
+ *
+ * A stream defined in terms of its own past, like state in server0,
+ * is written with fix. The function gets the stream's pre and returns its
+ * definition:
+ *
+ *   auto state = fix<text>([=](auto prev) {
+ *       return ifThenElse(wr, value, arrow(text{}, prev));
+ *   });
+ *
+ * pre, and prev, are the default value of their type at the first tick where
+ * Lustre leaves them undefined. Guard them with arrow to say what is meant.
+ *
+ * ->* binds tighter than the arithmetic operators, unlike Lustre's ->, so
+ * parenthesize its operands. && and || on streams evaluate both sides.
+ *
+ * See programs.hpp for the window controller and server0. The firmware
+ * needs CONFIG_CPLUSPLUS and CONFIG_LIB_CPLUSPLUS for a program in a .cpp
+ * file, and the app's CMakeLists.txt a glob for the .cpp files in src. The
+ * bench checks window against blexa_step, see ../bench/window.cpp.
+ */
+
+#include <cstddef>
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace lustre {
+
+/* Base of every node, the operators apply to the types derived from it */
+struct node {};
+
+template<class T>
+constexpr bool is_node_v = std::is_base_of_v<node, std::decay_t<T>>;
+
+/*********** State layout ***********/
+namespace detail {
+
+/* Empty states are not stored, they have no data that could differ. The
+ * slots are empty bases then, so they take no space.
+ */
+template<std::size_t I, class S, bool = std::is_empty_v<S>>
+struct slot {
+    S s;
+    S& get() { return s; }
+};
+
+template<std::size_t I, class S>
+struct slot<I, S, true> {
+    static inline S s{};
+    S& get() { return s; }
+};
+
+template<class Indices, class... S>
+struct states;
+
+template<std::size_t... I, class... S>
+struct states<std::index_sequence<I...>, S...> : slot<I, S>... {
+    template<std::size_t K>
+    auto& get() {
+        using SK = std::tuple_element_t<K, std::tuple<S...>>;
+        return static_cast<slot<K, SK>&>(*this).get();
+    }
+};
+
+} // namespace detail
+
+/* The states of the operands of a node, get<K>() is the Kth */
+template<class... S>
+using states = detail::states<std::index_sequence_for<S...>, S...>;
+
+/*********** Evaluation context ***********/
+namespace detail {
+
+/* The arguments of step */
+template<class... Args>
+struct inputs {
+    std::tuple<const Args&...> args;
+};
+
+/* Inside the definition of a fix, the last value of the stream, Tag tells
+ * nested fixes apart
+ */
+template<class Tag, class T, class Parent>
+struct feedback {
+    const T& last;
+    const Parent& parent;
+};
+
+template<std::size_t N, class... Args>
+const auto& arg(const inputs<Args...>& ctx) {
+    return std::get<N>(ctx.args);
+}
+
+template<std::size_t N, class Tag, class T, class Parent>
+const auto& arg(const feedback<Tag, T, Parent>& ctx) {
+    return arg<N>(ctx.parent);
+}
+
+template<class Tag, class CtxTag, class T, class Parent>
+const auto& last(const feedback<CtxTag, T, Parent>& ctx) {
+    if constexpr(std::is_same_v<Tag, CtxTag>) {
+        return ctx.last;
+    } else {
+        return last<Tag>(ctx.parent);
+    }
+}
+
+} // namespace detail
+
+/*********** Nodes ***********/
+template<class T>
+struct constant : node {
+    using value_type = T;
+    using state = states<>;
+
+    T value;
+
+    constexpr explicit constant(T v) : value(v) {}
+
+    void reset(state&) const {}
+
+    template<class Ctx>
+    T step(state&, const Ctx&) const {
+        return value;
+    }
+};
+
+template<class T, std::size_t N>
+struct input_node : node {
+    using value_type = T;
+    using state = states<>;
+
+    void reset(state&) const {}
+
+    template<class Ctx>
+    T step(state&, const Ctx& ctx) const {
+        return T(detail::arg<N>(ctx));
+    }
+};
+
+template<class F, class... A>
+struct map_node : node {
+    using value_type = std::decay_t<std::invoke_result_t<const F&, typename A::value_type...>>;
+    using state = states<typename A::state...>;
+
+    F f;
+    std::tuple<A...> operands;
+
+    constexpr map_node(F f, A... a) : f(f), operands(a...) {}
+
+    void reset(state& s) const {
+        reset(s, std::index_sequence_for<A...>{});
+    }
+
+    template<class Ctx>
+    value_type step(state& s, const Ctx& ctx) const {
+        return step(s, ctx, std::index_sequence_for<A...>{});
+    }
+
+private:
+    template<std::size_t... I>
+    void reset(state& s, std::index_sequence<I...>) const {
+        (std::get<I>(operands).reset(s.template get<I>()), ...);
+    }
+
+    // the operands do not share state, the order they are stepped in is moot
+    template<class Ctx, std::size_t... I>
+    value_type step(state& s, const Ctx& ctx, std::index_sequence<I...>) const {
+        return std::invoke(f, std::get<I>(operands).step(s.template get<I>(), ctx)...);
+    }
+};
+
+template<class A>
+struct pre_node : node {
+    using value_type = typename A::value_type;
+
+    struct state : states<typename A::state> {
+        value_type last;
+    };
+
+    A a;
+
+    constexpr explicit pre_node(A a) : a(a) {}
+
+    void reset(state& s) const {
+        a.reset(s.template get<0>());
+        s.last = value_type{};
+    }
+
+    template<class Ctx>
+    value_type step(state& s, const Ctx& ctx) const {
+        value_type out = s.last;
+        s.last = a.step(s.template get<0>(), ctx);
+        return out;
+    }
+};
+
+template<class A, class B>
+struct arrow_node : node {
+    using value_type = std::common_type_t<typename A::value_type, typename B::value_type>;
+
+    struct state : states<typename A::state, typename B::state> {
+        bool started;
+    };
+
+    A a;
+    B b;
+
+    constexpr arrow_node(A a, B b) : a(a), b(b) {}
+
+    void reset(state& s) const {
+        a.reset(s.template get<0>());
+        b.reset(s.template get<1>());
+        s.started = false;
+    }
+
+    template<class Ctx>
+    value_type step(state& s, const Ctx& ctx) const {
+        value_type first = a.step(s.template get<0>(), ctx);
+        value_type rest = b.step(s.template get<1>(), ctx);
+        bool started = s.started;
+        s.started = true;
+        return started ? rest : first;
+    }
+};
+
+template<class C, class A, class B>
+struct if_node : node {
+    using value_type = std::common_type_t<typename A::value_type, typename B::value_type>;
+    using state = states<typename C::state, typename A::state, typename B::state>;
+
+    C c;
+    A a;
+    B b;
+
+    constexpr if_node(C c, A a, B b) : c(c), a(a), b(b) {}
+
+    void reset(state& s) const {
+        c.reset(s.template get<0>());
+        a.reset(s.template get<1>());
+        b.reset(s.template get<2>());
+    }
+
+    template<class Ctx>
+    value_type step(state& s, const Ctx& ctx) const {
+        bool cond = c.step(s.template get<0>(), ctx);
+        value_type then = a.step(s.template get<1>(), ctx);
+        value_type otherwise = b.step(s.template get<2>(), ctx);
+        return cond ? then : otherwise;
+    }
+};
+
+/* pre of the fix with the same Tag */
+template<class T, class Tag>
+struct prev_node : node {
+    using value_type = T;
+    using state = states<>;
+
+    void reset(state&) const {}
+
+    template<class Ctx>
+    T step(state&, const Ctx& ctx) const {
+        return detail::last<Tag>(ctx);
+    }
+};
+
+template<class T, class Tag, class Body>
+struct fix_node : node {
+    using value_type = T;
+
+    struct state : states<typename Body::state> {
+        T last;
+    };
+
+    Body body;
+
+    constexpr explicit fix_node(Body body) : body(body) {}
+
+    void reset(state& s) const {
+        body.reset(s.template get<0>());
+        s.last = T{};
+    }
+
+    template<class Ctx>
+    T step(state& s, const Ctx& ctx) const {
+        detail::feedback<Tag, T, Ctx> inner{ s.last, ctx };
+        T out = body.step(s.template get<0>(), inner);
+        s.last = out;
+        return out;
+    }
+};
+
+/*********** Combinators ***********/
+namespace detail {
+
+template<class X>
+constexpr auto lift(X x) {
+    if constexpr(is_node_v<X>) {
+        return x;
+    } else {
+        return constant<X>(x);
+    }
+}
+
+template<class X>
+using lifted = decltype(lift(std::declval<X>()));
+
+} // namespace detail
+
+template<class T>
+constexpr constant<T> con(T x) {
+    return constant<T>(x);
+}
+
+template<class T, std::size_t N = 0>
+constexpr input_node<T, N> input() {
+    return {};
+}
+
+template<class F, class... X>
+constexpr auto map(F f, X... xs) {
+    return map_node<F, detail::lifted<X>...>(f, detail::lift(xs)...);
+}
+
+/* Applies a stream of functions, e.g. of partially applied ones */
+template<class Fs, class X>
+constexpr auto ap(Fs fs, X xs) {
+    return map([](const auto& f, const auto& x) { return f(x); }, fs, xs);
+}
+
+template<class X>
+constexpr auto pre(X xs) {
+    return pre_node<detail::lifted<X>>(detail::lift(xs));
+}
+
+template<class X, class Y>
+constexpr auto arrow(X xs, Y ys) {
+    return arrow_node<detail::lifted<X>, detail::lifted<Y>>(detail::lift(xs), detail::lift(ys));
+}
+
+template<class C, class X, class Y>
+constexpr auto ifThenElse(C c, X xs, Y ys) {
+    return if_node<detail::lifted<C>, detail::lifted<X>, detail::lifted<Y>>(
+        detail::lift(c), detail::lift(xs), detail::lift(ys));
+}
+
+/* The stream f(prev), where prev is its own pre */
+template<class T, class F>
+constexpr auto fix(F f) {
+    auto body = detail::lift(f(prev_node<T, F>{}));
+    return fix_node<T, F, decltype(body)>(body);
+}
+
+/*********** Operators ***********/
+#define LUSTRE_BINARY(op, fn) \
+    template<class X, class Y, \
+             class = std::enable_if_t<is_node_v<X> || is_node_v<Y>>> \
+    constexpr auto operator op(X xs, Y ys) { \
+        return map(fn{}, xs, ys); \
+    }
+
+#define LUSTRE_UNARY(op, fn) \
+    template<class X, class = std::enable_if_t<is_node_v<X>>> \
+    constexpr auto operator op(X xs) { \
+        return map(fn{}, xs); \
+    }
+
+LUSTRE_BINARY(+, std::plus<>)
+LUSTRE_BINARY(-, std::minus<>)
+LUSTRE_BINARY(*, std::multiplies<>)
+LUSTRE_BINARY(/, std::divides<>)
+LUSTRE_BINARY(%, std::modulus<>)
+LUSTRE_BINARY(==, std::equal_to<>)
+LUSTRE_BINARY(!=, std::not_equal_to<>)
+LUSTRE_BINARY(<, std::less<>)
+LUSTRE_BINARY(<=, std::less_equal<>)
+LUSTRE_BINARY(>, std::greater<>)
+LUSTRE_BINARY(>=, std::greater_equal<>)
+LUSTRE_BINARY(&&, std::logical_and<>)
+LUSTRE_BINARY(||, std::logical_or<>)
+LUSTRE_UNARY(-, std::negate<>)
+LUSTRE_UNARY(!, std::logical_not<>)
+
+#undef LUSTRE_BINARY
+#undef LUSTRE_UNARY
+
+template<class X, class Y, class = std::enable_if_t<is_node_v<X> || is_node_v<Y>>>
+constexpr auto operator->*(X xs, Y ys) {
+    return arrow(xs, ys);
+}
+
+/*********** Programs ***********/
+/* A node and its memory. step() takes the inputs of one tick and returns
+ * the output.
+ */
+template<class Node>
+class program {
+public:
+    using value_type = typename Node::value_type;
+    using state = typename Node::state;
+
+    static_assert(std::is_trivially_copyable_v<state>,
+                  "the state of a program is plain data");
+
+    constexpr explicit program(Node node) : node_(node), state_() {
+        reset();
+    }
+
+    void reset() {
+        node_.reset(state_);
+    }
+
+    template<class... Args>
+    value_type step(const Args&... args) {
+        return node_.step(state_, detail::inputs<Args...>{ { args... } });
+    }
+
+    /* For a runtime that keeps or compares states itself */
+    state& memory() {
+        return state_;
+    }
+
+private:
+    Node node_;
+    state state_;
+};
+
+template<class Node>
+program(Node) -> program<Node>;
+
+} // namespace lustre
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef PROGRAMS_BLE
+#define PROGRAMS_BLE
+
+/* The example programs written with lustre.hpp.
+ *
+ * window is the program DSLustre generated blexa_step from, and steps the
+ * same. server0 is the one of Bluetooth.hs, with the String of its state
+ * as a fixed size buffer.
+ */
+
+#include "lustre.hpp"
+
+#include <cstdint>
+
+namespace programs {
+
+/* Inputs: the temperature, and the octavius value, where 2 gives permission
+ * to open the window, 1 withdraws it and 0 leaves it as it was. Output: 1
+ * opens the window, 0 closes it and 2 is no permission.
+ */
+inline auto window() {
+    using namespace lustre;
+
+    auto temperature = input<int, 0>();
+    auto octavius = input<int, 1>();
+
+    auto permitted = fix<bool>([=](auto prev) {
+        return ifThenElse(octavius == 2, true,
+               ifThenElse(octavius == 1, false,
+                          arrow(false, prev)));
+    });
+
+    return ifThenElse(permitted, ifThenElse(temperature > 30, 1, 0), 2);
+}
+
+/* At most one notification payload */
+#define PROGRAMS_TEXT_MAX 20
+
+struct text {
+    std::uint8_t len;
+    char data[PROGRAMS_TEXT_MAX];
+};
+
+/* Receive agent msg */
+struct message {
+    int agent;
+    bool write;   // Write, the text is in value, or Read
+    text value;
+};
+
+/* Send [] when any is false, Send [(agent, value)] otherwise */
+struct send {
+    bool any;
+    int agent;
+    text value;
+};
+
+/* Anyone can Write the text, anyone can Read it */
+inline auto server0() {
+    using namespace lustre;
+
+    auto inp = input<message, 0>();
+    auto wr = map([](const message& m) { return m.write; }, inp);
+    auto str = map([](const message& m) { return m.value; }, inp);
+
+    auto state = fix<text>([=](auto prev) {
+        return ifThenElse(wr, str, arrow(text{}, prev));
+    });
+
+    return ifThenElse(wr, send{},
+                      map([](const message& m, const text& s) {
+                              return send{ true, m.agent, s };
+                          }, inp, state));
+}
+
+} // namespace programs
+
+#endif
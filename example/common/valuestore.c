@@ -0,0 +1,43 @@
+#include "valuestore.h"
+
+#include <zephyr.h>
+#include <string.h>
+#include <errno.h>
+
+/* The atomic operations are full barriers, for the compiler as well, so the
+ * copies can not move across the updates of the sequence number.
+ */
+
+int value_store_write(struct value_slot* slot, const void* data, u8_t len) {
+    if(len > VALUE_SLOT_SIZE) {
+        return -EINVAL;
+    }
+    if(atomic_test_and_set_bit(&slot->writing, 0)) {
+        return -EBUSY;
+    }
+
+    // readers move to copy 1 while copy 0 is written, then back
+    atomic_inc(&slot->seq);
+    memcpy(slot->copy[0].data, data, len);
+    slot->copy[0].len = len;
+    atomic_inc(&slot->seq);
+    memcpy(slot->copy[1].data, data, len);
+    slot->copy[1].len = len;
+
+    atomic_clear_bit(&slot->writing, 0);
+    return 0;
+}
+
+u32_t value_store_read(struct value_slot* slot, void* data, u8_t* len) {
+    atomic_val_t seq;
+
+    do {
+        seq = atomic_get(&slot->seq);
+        const struct value_copy* c = &slot->copy[seq & 1];
+
+        *len = MIN(c->len, VALUE_SLOT_SIZE);
+        memcpy(data, c->data, *len);
+    } while(atomic_get(&slot->seq) != seq);
+
+    return (u32_t)seq >> 1;
+}
@@ -0,0 +1,73 @@
+#ifndef VALUESTORE_BLE
+#define VALUESTORE_BLE
+
+#include <zephyr.h>
+#include <string.h>
+#include <sys/atomic.h>
+
+/* Attribute values shared between the thread that samples them and the
+ * Bluetooth thread that reads and notifies them.
+ *
+ * A struct value_slot is a seqlock with two copies of the value (a latch).
+ * The sequence number says which copy is stable: while a write is under way
+ * readers take the copy that still holds the previous value, so a reader that
+ * preempted the writer never has to wait for it. A reader only retries when
+ * a write completed during its copy, which on a single core can only happen
+ * when the reader itself was preempted. Writers do not take a lock either, a
+ * write that overlaps another write to the same slot fails with -EBUSY.
+ *
+ * Every completed write bumps the version by one, so it can be compared to
+ * tell whether a value changed since it was last looked at.
+ */
+
+/* Large enough for any value a characteristic holds */
+#define VALUE_SLOT_SIZE 8
+
+struct value_copy {
+    u8_t len;
+    u8_t data[VALUE_SLOT_SIZE];
+};
+
+struct value_slot {
+    atomic_t seq;       // twice the version, plus one while a write is under way
+    atomic_t writing;
+    struct value_copy copy[2];
+};
+
+/* Writes len bytes of data, which must not exceed VALUE_SLOT_SIZE. Returns 0,
+ * -EINVAL when the value does not fit or -EBUSY when another write is under
+ * way.
+ */
+int value_store_write(struct value_slot* slot, const void* data, u8_t len);
+
+/* Copies the value to data, which must hold VALUE_SLOT_SIZE bytes, and its
+ * length to len. Returns the version of the value that was copied.
+ */
+u32_t value_store_read(struct value_slot* slot, void* data, u8_t* len);
+
+static inline u32_t value_store_version(struct value_slot* slot) {
+    return (u32_t)atomic_get(&slot->seq) >> 1;
+}
+
+/* The sensors of the examples hold a single int */
+static inline int value_store_set_int(struct value_slot* slot, int value) {
+    return value_store_write(slot, &value, sizeof(value));
+}
+
+/* version may be NULL */
+static inline int value_store_get_int(struct value_slot* slot, u32_t* version) {
+    int value = 0;
+    u8_t data[VALUE_SLOT_SIZE];
+    u8_t len;
+    u32_t v = value_store_read(slot, data, &len);
+
+    if(version) {
+        *version = v;
+    }
+    if(len == sizeof(value)) {
+        memcpy(&value, data, sizeof(value));
+    }
+    return value;
+}
+
+#endif
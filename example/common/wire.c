@@ -0,0 +1,254 @@
+/* Generated by WireGen.hs from wire.schema, do not edit by hand. */
+
+#include "wire.h"
+
+#include <errno.h>
+#include <string.h>
+
+struct wire_view {
+    const u8_t* p;
+    const u8_t* end;
+};
+
+struct wire_out {
+    u8_t* p;
+    u8_t* end;
+};
+
+static int put_uint(struct wire_out* o, u32_t x) {
+    do {
+        if(o->p == o->end) {
+            return -ENOMEM;
+        }
+        u8_t b = x & 0x7f;
+        x >>= 7;
+        *o->p++ = x ? (b | 0x80) : b;
+    } while(x);
+    return 0;
+}
+
+static int get_uint(struct wire_view* v, u32_t* x) {
+    u32_t res = 0;
+    for(int shift = 0; shift < 35; shift += 7) {
+        if(v->p == v->end) {
+            return -EINVAL;
+        }
+        u8_t b = *v->p++;
+        /* the fifth byte only carries bits 28 to 31 */
+        if(shift == 28 && b > 0x0f) {
+            return -EINVAL;
+        }
+        res |= (u32_t)(b & 0x7f) << shift;
+        if(!(b & 0x80)) {
+            *x = res;
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+static int put_sint(struct wire_out* o, s32_t x) {
+    return put_uint(o, ((u32_t)x << 1) ^ (u32_t)(x >> 31));
+}
+
+static int get_sint(struct wire_view* v, s32_t* x) {
+    u32_t u;
+    int err = get_uint(v, &u);
+    if(!err) {
+        *x = (s32_t)((u >> 1) ^ (0U - (u & 1)));
+    }
+    return err;
+}
+
+static int put_bytes(struct wire_out* o, struct wire_bytes x) {
+    int err = put_uint(o, x.len);
+    if(err) {
+        return err;
+    }
+    if(o->end - o->p < x.len) {
+        return -ENOMEM;
+    }
+    memcpy(o->p, x.data, x.len);
+    o->p += x.len;
+    return 0;
+}
+
+/* Does not copy, the result points into the decoded buffer */
+static int get_bytes(struct wire_view* v, struct wire_bytes* x) {
+    u32_t len;
+    int err = get_uint(v, &len);
+    if(err) {
+        return err;
+    }
+    if(len > (u32_t)(v->end - v->p)) {
+        return -EINVAL;
+    }
+    x->data = v->p;
+    x->len = len;
+    v->p += len;
+    return 0;
+}
+
+/********** union Sample **********/
+int wire_encode_sample(const struct wire_sample* msg, void* buf, u16_t len) {
+    struct wire_out o = { buf, (u8_t*)buf + len };
+    int err = put_uint(&o, msg->tag);
+
+    switch(msg->tag) {
+    case WIRE_SAMPLE_TEMPERATURE:
+        err = err ? err : put_sint(&o, msg->temperature.value);
+        err = err ? err : put_uint(&o, msg->temperature.seq);
+        break;
+    case WIRE_SAMPLE_OCTAVIUS:
+        err = err ? err : put_uint(&o, msg->octavius.open);
+        err = err ? err : put_uint(&o, msg->octavius.seq);
+        break;
+    default:
+        err = -EINVAL;
+    }
+    return err ? err : o.p - (u8_t*)buf;
+}
+
+int wire_decode_sample(const void* buf, u16_t len, struct wire_sample* msg) {
+    struct wire_view v = { buf, (const u8_t*)buf + len };
+    u32_t tag;
+    int err = get_uint(&v, &tag);
+
+    if(err) {
+        return err;
+    }
+    msg->tag = tag;
+    switch(msg->tag) {
+    case WIRE_SAMPLE_TEMPERATURE:
+        err = err ? err : get_sint(&v, &msg->temperature.value);
+        err = err ? err : get_uint(&v, &msg->temperature.seq);
+        break;
+    case WIRE_SAMPLE_OCTAVIUS:
+        err = err ? err : get_uint(&v, &msg->octavius.open);
+        err = err ? err : get_uint(&v, &msg->octavius.seq);
+        break;
+    default:
+        return -EINVAL;
+    }
+    return err ? err : v.p - (const u8_t*)buf;
+}
+
+/********** union Broadcast **********/
+int wire_encode_broadcast(const struct wire_broadcast* msg, void* buf, u16_t len) {
+    struct wire_out o = { buf, (u8_t*)buf + len };
+    int err = put_uint(&o, msg->tag);
+
+    switch(msg->tag) {
+    case WIRE_BROADCAST_SAMPLES:
+        err = err ? err : put_uint(&o, msg->samples.version);
+        err = err ? err : put_sint(&o, msg->samples.temperature);
+        err = err ? err : put_uint(&o, msg->samples.octavius);
+        break;
+    default:
+        err = -EINVAL;
+    }
+    return err ? err : o.p - (u8_t*)buf;
+}
+
+int wire_decode_broadcast(const void* buf, u16_t len, struct wire_broadcast* msg) {
+    struct wire_view v = { buf, (const u8_t*)buf + len };
+    u32_t tag;
+    int err = get_uint(&v, &tag);
+
+    if(err) {
+        return err;
+    }
+    msg->tag = tag;
+    switch(msg->tag) {
+    case WIRE_BROADCAST_SAMPLES:
+        err = err ? err : get_uint(&v, &msg->samples.version);
+        err = err ? err : get_sint(&v, &msg->samples.temperature);
+        err = err ? err : get_uint(&v, &msg->samples.octavius);
+        break;
+    default:
+        return -EINVAL;
+    }
+    return err ? err : v.p - (const u8_t*)buf;
+}
+
+/********** union History **********/
+int wire_encode_history(const struct wire_history* msg, void* buf, u16_t len) {
+    struct wire_out o = { buf, (u8_t*)buf + len };
+    int err = put_uint(&o, msg->tag);
+
+    switch(msg->tag) {
+    case WIRE_HISTORY_SINCE:
+        err = err ? err : put_uint(&o, msg->since.seq);
+        break;
+    case WIRE_HISTORY_RUN:
+        err = err ? err : put_uint(&o, msg->run.newest);
+        err = err ? err : put_uint(&o, msg->run.age);
+        err = err ? err : put_bytes(&o, msg->run.samples);
+        break;
+    default:
+        err = -EINVAL;
+    }
+    return err ? err : o.p - (u8_t*)buf;
+}
+
+int wire_decode_history(const void* buf, u16_t len, struct wire_history* msg) {
+    struct wire_view v = { buf, (const u8_t*)buf + len };
+    u32_t tag;
+    int err = get_uint(&v, &tag);
+
+    if(err) {
+        return err;
+    }
+    msg->tag = tag;
+    switch(msg->tag) {
+    case WIRE_HISTORY_SINCE:
+        err = err ? err : get_uint(&v, &msg->since.seq);
+        break;
+    case WIRE_HISTORY_RUN:
+        err = err ? err : get_uint(&v, &msg->run.newest);
+        err = err ? err : get_uint(&v, &msg->run.age);
+        err = err ? err : get_bytes(&v, &msg->run.samples);
+        break;
+    default:
+        return -EINVAL;
+    }
+    return err ? err : v.p - (const u8_t*)buf;
+}
+
+/********** union Msg **********/
+int wire_encode_msg(const struct wire_msg* msg, void* buf, u16_t len) {
+    struct wire_out o = { buf, (u8_t*)buf + len };
+    int err = put_uint(&o, msg->tag);
+
+    switch(msg->tag) {
+    case WIRE_MSG_READ:
+        break;
+    case WIRE_MSG_WRITE:
+        err = err ? err : put_bytes(&o, msg->write.text);
+        break;
+    default:
+        err = -EINVAL;
+    }
+    return err ? err : o.p - (u8_t*)buf;
+}
+
+int wire_decode_msg(const void* buf, u16_t len, struct wire_msg* msg) {
+    struct wire_view v = { buf, (const u8_t*)buf + len };
+    u32_t tag;
+    int err = get_uint(&v, &tag);
+
+    if(err) {
+        return err;
+    }
+    msg->tag = tag;
+    switch(msg->tag) {
+    case WIRE_MSG_READ:
+        break;
+    case WIRE_MSG_WRITE:
+        err = err ? err : get_bytes(&v, &msg->write.text);
+        break;
+    default:
+        return -EINVAL;
+    }
+    return err ? err : v.p - (const u8_t*)buf;
+}
@@ -0,0 +1,105 @@
+#ifndef WIRE_BLE
+#define WIRE_BLE
+
+/* Generated by WireGen.hs from wire.schema, do not edit by hand.
+ *
+ * The encoders return the number of bytes written and the decoders the
+ * number of bytes consumed, or a negative error code.
+ */
+
+#include <zephyr/types.h>
+
+/* A view of length-prefixed bytes inside the buffer that was decoded.
+ * It is only valid as long as that buffer is.
+ */
+struct wire_bytes {
+    const u8_t* data;
+    u16_t len;
+};
+
+/* union Sample */
+enum wire_sample_tag {
+    WIRE_SAMPLE_TEMPERATURE = 1,
+    WIRE_SAMPLE_OCTAVIUS = 2,
+};
+
+struct wire_sample {
+    enum wire_sample_tag tag;
+    union {
+        struct {
+            s32_t value;
+            u32_t seq;
+        } temperature;
+        struct {
+            u32_t open;
+            u32_t seq;
+        } octavius;
+    };
+};
+
+#define WIRE_SAMPLE_MAX_SIZE 15
+int wire_encode_sample(const struct wire_sample* msg, void* buf, u16_t len);
+int wire_decode_sample(const void* buf, u16_t len, struct wire_sample* msg);
+
+/* union Broadcast */
+enum wire_broadcast_tag {
+    WIRE_BROADCAST_SAMPLES = 1,
+};
+
+struct wire_broadcast {
+    enum wire_broadcast_tag tag;
+    union {
+        struct {
+            u32_t version;
+            s32_t temperature;
+            u32_t octavius;
+        } samples;
+    };
+};
+
+#define WIRE_BROADCAST_MAX_SIZE 20
+int wire_encode_broadcast(const struct wire_broadcast* msg, void* buf, u16_t len);
+int wire_decode_broadcast(const void* buf, u16_t len, struct wire_broadcast* msg);
+
+/* union History */
+enum wire_history_tag {
+    WIRE_HISTORY_SINCE = 16,
+    WIRE_HISTORY_RUN = 17,
+};
+
+struct wire_history {
+    enum wire_history_tag tag;
+    union {
+        struct {
+            u32_t seq;
+        } since;
+        struct {
+            u32_t newest;
+            u32_t age;
+            struct wire_bytes samples;
+        } run;
+    };
+};
+
+int wire_encode_history(const struct wire_history* msg, void* buf, u16_t len);
+int wire_decode_history(const void* buf, u16_t len, struct wire_history* msg);
+
+/* union Msg */
+enum wire_msg_tag {
+    WIRE_MSG_READ = 1,
+    WIRE_MSG_WRITE = 2,
+};
+
+struct wire_msg {
+    enum wire_msg_tag tag;
+    union {
+        struct {
+            struct wire_bytes text;
+        } write;
+    };
+};
+
+int wire_encode_msg(const struct wire_msg* msg, void* buf, u16_t len);
+int wire_decode_msg(const void* buf, u16_t len, struct wire_msg* msg);
+
+#endif
@@ -0,0 +1,433 @@
+/* main.c - Gateway between sensor servers and upstream centrals */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr.h>
+#include <sys/printk.h>
+#include <sys/byteorder.h>
+#include <net/buf.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/uuid.h>
+#include <bluetooth/gatt.h>
+
+#include "api.h"
+#include "wire.h"
+#include "linkstats.h"
+
+#define DEVICE                             0xffcc
+
+#define TEMPERATURE_SENSOR_SERVICE         0xff11
+#define TEMPERATURE_SENSOR_CHARACTERISTIC  0xff12
+
+#define OCTAVIUS_SERVICE                   0xff21
+#define OCTAVIUS_CHARACTERISTIC            0xff22
+
+#define BT_UUID_GATEWAY_SERVICE            BT_UUID_DECLARE_16(0xff41)
+#define BT_UUID_GATEWAY_SAMPLES            BT_UUID_DECLARE_16(0xff42)
+#define BT_UUID_GATEWAY_FILTER             BT_UUID_DECLARE_16(0xff43)
+
+// sensor links, at most MAX_CONNECTIONS in the client's bt.c
+#define SENSORS   5
+// upstream links, CONFIG_BT_MAX_CONN covers both
+#define UPSTREAMS 2
+// the octavius and temperature of every sensor
+#define CHARACTERISTICS 2
+#define STREAMS   (SENSORS * CHARACTERISTICS)
+
+/*********** Sensors ***********/
+/* The key of a sensor link is a connection slot of the client's bt.c, which
+ * changes when the sensor reconnects. The sensor index forwarded upstream,
+ * and the bit of the sensor in the upstream filters, is that of the peer
+ * instead: every sensor address keeps its index for as long as it is not
+ * replaced by a new one, as find_peer in ../client/src/main.c does.
+ */
+struct sensor {
+    bool used;
+    u8_t addr[6];
+    u32_t seen;  // uptime of the last connection
+};
+
+static struct sensor sensors[SENSORS];
+static int sensor_of_key[CONFIG_BT_MAX_CONN]; // -1 when not a sensor
+
+static bool sensor_connected(int sensor) {
+    for(int i = 0; i < CONFIG_BT_MAX_CONN; i++) {
+        if(sensor_of_key[i] == sensor) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* A sensor we have not seen before takes the index of the one seen longest
+ * ago. Returns -1 when all are connected.
+ */
+static int find_sensor(const u8_t addr[6]) {
+    int replace = -1;
+
+    for(int i = 0; i < SENSORS; i++) {
+        struct sensor* s = &sensors[i];
+
+        if(s->used && !memcmp(s->addr, addr, sizeof(s->addr))) {
+            return i;
+        }
+        if(!sensor_connected(i) &&
+           (replace < 0 || !s->used ||
+            (sensors[replace].used && s->seen < sensors[replace].seen))) {
+            replace = i;
+        }
+    }
+
+    if(replace >= 0) {
+        sensors[replace].used = true;
+        memcpy(sensors[replace].addr, addr, sizeof(sensors[replace].addr));
+    }
+    return replace;
+}
+
+/*********** Forwarding buffers ***********/
+/* The notification data we get from a sensor is only valid during the
+ * callback, so it is copied once into a buffer from this pool, behind a byte
+ * with the sensor index. From there on every upstream that sends it or holds
+ * it back takes a reference, and the buffer returns to the pool when the last
+ * one is done with it.
+ */
+#define FORWARD_BUF_SIZE (1 + WIRE_SAMPLE_MAX_SIZE)
+#define FORWARD_BUFS     (STREAMS + UPSTREAMS * STREAMS)
+
+NET_BUF_POOL_FIXED_DEFINE(forward_pool, FORWARD_BUFS, FORWARD_BUF_SIZE, NULL);
+
+/*********** Upstream links ***********/
+/* Every upstream central has a filter, the sensors it wants and the minimum
+ * time between two notifications for the same characteristic of a sensor.
+ * A value that arrives too early is held back as pending, replacing older
+ * pending values of that characteristic, and is sent by flush_work when the
+ * interval has passed. The characteristics of a sensor are limited apart,
+ * so the one that changes more often does not starve the other.
+ */
+struct upstream {
+    struct bt_conn* conn;
+    u32_t sensors;          // mask of the sensors to forward
+    u16_t min_interval_ms;  // 0 forwards everything
+    u32_t last_sent[STREAMS];
+    struct net_buf* pending[STREAMS];
+};
+
+static int stream_of(int sensor, struct value* val) {
+    return sensor * CHARACTERISTICS +
+           (val->characteristic_uuid == OCTAVIUS_CHARACTERISTIC);
+}
+
+K_MUTEX_DEFINE(upstreams_lock);
+static struct upstream upstreams[CONFIG_BT_MAX_CONN]; // by bt_conn_index
+static int n_upstreams;
+static struct k_delayed_work flush_work;
+
+static ssize_t write_filter(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                            const void* buf, u16_t len, u16_t offset, u8_t flags);
+
+BT_GATT_SERVICE_DEFINE(gateway,
+	BT_GATT_PRIMARY_SERVICE(BT_UUID_GATEWAY_SERVICE),
+	BT_GATT_CHARACTERISTIC(BT_UUID_GATEWAY_SAMPLES,
+			       BT_GATT_CHRC_NOTIFY,
+			       BT_GATT_PERM_NONE, NULL, NULL, NULL),
+	BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+	BT_GATT_CHARACTERISTIC(BT_UUID_GATEWAY_FILTER,
+			       BT_GATT_CHRC_WRITE,
+			       BT_GATT_PERM_WRITE, NULL, write_filter, NULL),
+);
+
+static ssize_t write_filter(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                            const void* buf, u16_t len, u16_t offset, u8_t flags) {
+    struct upstream* up = &upstreams[bt_conn_index(conn)];
+
+    if(offset) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+    if(len != sizeof(u32_t) + sizeof(u16_t)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    k_mutex_lock(&upstreams_lock, K_FOREVER);
+    up->sensors = sys_get_le32(buf);
+    up->min_interval_ms = sys_get_le16((const u8_t*)buf + sizeof(u32_t));
+    k_mutex_unlock(&upstreams_lock);
+
+    printk("Upstream filter: sensors 0x%08x, at most one per %u ms\n",
+           up->sensors, up->min_interval_ms);
+    return len;
+}
+
+static void sent(struct bt_conn* conn, void* user_data) {
+    net_buf_unref(user_data);
+}
+
+/* A value that is due on an upstream. It is picked under upstreams_lock and
+ * sent after releasing it, as the stack may block for a buffer and the
+ * connection callbacks take the lock too. The references keep the link and
+ * the buffer alive in between.
+ */
+struct outgoing {
+    struct bt_conn* conn;
+    struct net_buf* buf;
+};
+
+/* The stack copies the data into its own PDU, the buffer reference we hand
+ * over keeps our buffer alive until it has done so
+ */
+static void send(struct outgoing* out) {
+    struct bt_gatt_notify_params params = {
+        .attr = &gateway.attrs[1],
+        .data = out->buf->data,
+        .len = out->buf->len,
+        .func = sent,
+        .user_data = out->buf,
+    };
+
+    int err = bt_gatt_notify_cb(out->conn, &params);
+    if(err) {
+        net_buf_unref(out->buf);
+        link_stats_error(out->conn);
+    } else {
+        link_stats_tx(out->conn, params.len);
+    }
+    bt_conn_unref(out->conn);
+}
+
+/* Must hold upstreams_lock. Returns the ms until a held back value is due,
+ * or -1 if nothing was held back. A value that is due now is added to out,
+ * to be sent once the lock is released.
+ */
+static s32_t offer(struct upstream* up, int stream, struct net_buf* buf,
+                   struct outgoing* out, int* n_out) {
+    if(!(up->sensors & BIT(stream / CHARACTERISTICS)) ||
+       !bt_gatt_is_subscribed(up->conn, &gateway.attrs[2], BT_GATT_CCC_NOTIFY)) {
+        return -1;
+    }
+
+    u32_t now = k_uptime_get_32();
+    u32_t elapsed = now - up->last_sent[stream];
+    if(elapsed >= up->min_interval_ms) {
+        up->last_sent[stream] = now;
+        out[*n_out].conn = bt_conn_ref(up->conn);
+        out[*n_out].buf = net_buf_ref(buf);
+        (*n_out)++;
+        return -1;
+    }
+
+    if(up->pending[stream]) {
+        net_buf_unref(up->pending[stream]);
+    }
+    up->pending[stream] = net_buf_ref(buf);
+    return up->min_interval_ms - elapsed;
+}
+
+static void schedule_flush(s32_t delay) {
+    s32_t remaining = k_delayed_work_remaining_get(&flush_work);
+
+    if(delay >= 0 && (!remaining || delay < remaining)) {
+        k_delayed_work_submit(&flush_work, K_MSEC(delay));
+    }
+}
+
+/* One upstream at a time, so that out only needs room for its streams */
+static void flush(struct k_work* work) {
+    struct outgoing out[STREAMS];
+    s32_t next = -1;
+
+    for(int i = 0; i < CONFIG_BT_MAX_CONN; i++) {
+        struct upstream* up = &upstreams[i];
+        int n_out = 0;
+
+        k_mutex_lock(&upstreams_lock, K_FOREVER);
+        for(int stream = 0; up->conn && stream < STREAMS; stream++) {
+            struct net_buf* buf = up->pending[stream];
+            if(!buf) {
+                continue;
+            }
+
+            up->pending[stream] = NULL;
+            s32_t delay = offer(up, stream, buf, out, &n_out);
+            net_buf_unref(buf);
+            if(delay >= 0 && (next < 0 || delay < next)) {
+                next = delay;
+            }
+        }
+        k_mutex_unlock(&upstreams_lock);
+
+        for(int j = 0; j < n_out; j++) {
+            send(&out[j]);
+        }
+    }
+
+    schedule_flush(next);
+}
+
+/* Notification from a sensor */
+static void forward(struct value* val, const void* data, int len) {
+    int sensor = -1;
+    struct outgoing out[CONFIG_BT_MAX_CONN];
+    int n_out = 0;
+    struct net_buf* buf;
+    s32_t next = -1;
+
+    if(val->conn_key >= 0 && val->conn_key < CONFIG_BT_MAX_CONN) {
+        sensor = sensor_of_key[val->conn_key];
+    }
+    if(sensor < 0 || len > WIRE_SAMPLE_MAX_SIZE) {
+        printk("Not forwarding notification (sensor %d, len %d)\n", sensor, len);
+        return;
+    }
+
+    buf = net_buf_alloc(&forward_pool, K_NO_WAIT);
+    if(!buf) {
+        printk("Forward buffers exhausted, dropping value of sensor %d\n", sensor);
+        link_stats_drop(val->conn);
+        return;
+    }
+    net_buf_add_u8(buf, sensor);
+    net_buf_add_mem(buf, data, len);
+
+    k_mutex_lock(&upstreams_lock, K_FOREVER);
+    for(int i = 0; i < CONFIG_BT_MAX_CONN; i++) {
+        if(upstreams[i].conn) {
+            s32_t delay = offer(&upstreams[i], stream_of(sensor, val), buf,
+                                out, &n_out);
+            if(delay >= 0 && (next < 0 || delay < next)) {
+                next = delay;
+            }
+        }
+    }
+    k_mutex_unlock(&upstreams_lock);
+
+    for(int i = 0; i < n_out; i++) {
+        send(&out[i]);
+    }
+    net_buf_unref(buf);
+    schedule_flush(next);
+}
+
+static const struct bt_data ad[] = {
+	BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
+	// 0xdd & 0xff is the uuid of the gateway
+	BT_DATA_BYTES(BT_DATA_UUID16_ALL, 0xdd, 0xff),
+};
+
+static void advertise(void) {
+    int err = bt_le_adv_start(BT_LE_ADV_CONN_NAME, ad, ARRAY_SIZE(ad), NULL, 0);
+    if(err && err != -EALREADY) {
+        printk("Advertising failed to start (err %d)\n", err);
+    }
+}
+
+static bool is_upstream(struct bt_conn* conn) {
+    struct bt_conn_info info;
+
+    return !bt_conn_get_info(conn, &info) && info.role == BT_CONN_ROLE_SLAVE;
+}
+
+static void upstream_connected(struct bt_conn* conn, u8_t err) {
+    if(err || !is_upstream(conn)) {
+        return;
+    }
+
+    k_mutex_lock(&upstreams_lock, K_FOREVER);
+    struct upstream* up = &upstreams[bt_conn_index(conn)];
+    memset(up, 0, sizeof(*up));
+    up->conn = bt_conn_ref(conn);
+    up->sensors = BIT_MASK(SENSORS);
+    n_upstreams++;
+    k_mutex_unlock(&upstreams_lock);
+
+    printk("Upstream connected (%d of %d)\n", n_upstreams, UPSTREAMS);
+
+    /* Advertising stops when a connection is made */
+    if(n_upstreams < UPSTREAMS) {
+        advertise();
+    }
+}
+
+static void upstream_disconnected(struct bt_conn* conn, u8_t reason) {
+    struct upstream* up = &upstreams[bt_conn_index(conn)];
+
+    k_mutex_lock(&upstreams_lock, K_FOREVER);
+    if(up->conn != conn) {
+        k_mutex_unlock(&upstreams_lock);
+        return;
+    }
+
+    for(int stream = 0; stream < STREAMS; stream++) {
+        if(up->pending[stream]) {
+            net_buf_unref(up->pending[stream]);
+            up->pending[stream] = NULL;
+        }
+    }
+    bt_conn_unref(up->conn);
+    up->conn = NULL;
+    n_upstreams--;
+    k_mutex_unlock(&upstreams_lock);
+
+    printk("Upstream disconnected (reason 0x%02x)\n", reason);
+    advertise();
+}
+
+static struct bt_conn_cb upstream_callbacks = {
+	.connected = upstream_connected,
+	.disconnected = upstream_disconnected,
+};
+
+/*********** Sensor links ***********/
+void scanned_callback(struct value* val) {
+    subscribe_characteristic_value(val, forward);
+}
+
+void connected(struct conn* id) {
+    u8_t addr[6];
+    int sensor = -1;
+
+    if(!get_peer_address(id, addr)) {
+        sensor = find_sensor(addr);
+    }
+    if(sensor >= 0) {
+        sensors[sensor].seen = k_uptime_get_32();
+    }
+    sensor_of_key[id->key] = sensor;
+
+    printk("Sensor %d connected\n", sensor);
+    scan_for_characteristic(id,
+                            OCTAVIUS_SERVICE,
+                            OCTAVIUS_CHARACTERISTIC,
+                            scanned_callback);
+    scan_for_characteristic(id,
+                            TEMPERATURE_SENSOR_SERVICE,
+                            TEMPERATURE_SENSOR_CHARACTERISTIC,
+                            scanned_callback);
+}
+
+void disconnected(struct conn* id) {
+    printk("Sensor %d disconnected\n", sensor_of_key[id->key]);
+    sensor_of_key[id->key] = -1;
+    try_connect(DEVICE);
+}
+
+void main() {
+    k_delayed_work_init(&flush_work, flush);
+    for(int i = 0; i < CONFIG_BT_MAX_CONN; i++) {
+        sensor_of_key[i] = -1;
+    }
+
+    start_bt();
+    bt_conn_cb_register(&upstream_callbacks);
+
+    register_connected_callback(connected);
+    register_disconnected_callback(disconnected);
+    for(int i = 0; i < SENSORS; i++) {
+        try_connect(DEVICE);
+    }
+
+    advertise();
+}
@@ -19,6 +19,12 @@
 #include <bluetooth/conn.h>
 #include <bluetooth/uuid.h>
 #include <bluetooth/gatt.h>
+#include <settings/settings.h>
+
+#include "wire.h"
+#include "linkstats.h"
+#include "valuestore.h"
+#include "history.h"
 
 #define BT_UUID_DEVICE                             BT_UUID_DECLARE_16(0xffcc)
 
@@ -28,86 +34,418 @@
 #define BT_UUID_OCTAVIUS_SERVICE                   BT_UUID_DECLARE_16(0xff21)
 #define BT_UUID_OCTAVIUS_CHARACTERISTIC            BT_UUID_DECLARE_16(0xff22)
 
-/*********************************/
-int temperature;
+struct bt_conn *default_conn;
+
+static void broadcast_update(void);
 
-static void tempoct_ccc_cfg_changed(const struct bt_gatt_attr *attr,
-				       u16_t value)
+/* Account a notification in the link statistics of our client */
+static void count_notify(const struct bt_gatt_attr *attr, int rc, u16_t len)
 {
-	ARG_UNUSED(attr);
+	if (!default_conn) {
+		return;
+	}
 
-	bool notif_enabled = (value == BT_GATT_CCC_NOTIFY);
+	if (rc) {
+		link_stats_error(default_conn);
+	} else if (bt_gatt_is_subscribed(default_conn, attr, BT_GATT_CCC_NOTIFY)) {
+		link_stats_tx(default_conn, len);
+	}
+}
 
-	printk("Temperature Notifications %s\n", notif_enabled ? "enabled" : "disabled");
+/********** Sensors **********/
+/* Every sensor is a line of SENSORS: its name, the uuids of its service and
+ * characteristic, and the tag and value field of its Sample in the wire
+ * format. Everything else is generated from the line: the state, one service
+ * in a shared attribute table, the encoding of its samples, and
+ * bt_gatt_get_<name>/bt_gatt_set_<name>.
+ *
+ * The values are written by the main thread and read by the Bluetooth
+ * thread, see valuestore.h. Every write is also kept in a history ring, see
+ * history.h, and the version of the value is the sequence number of the
+ * sample.
+ *
+ * The services get their handles in the order of SENSORS. Octavius comes
+ * first, as it did when the services were defined apart and sorted by name,
+ * so bonded clients keep the handles they cached. New sensors go at the end.
+ */
+#define SENSORS(X)								\
+	X(octavius, "Octavius", BT_UUID_OCTAVIUS_SERVICE,			\
+	  BT_UUID_OCTAVIUS_CHARACTERISTIC, OCTAVIUS, open)			\
+	X(temperature, "Temperature", BT_UUID_TEMPERATURE_SENSOR_SERVICE,	\
+	  BT_UUID_TEMPERATURE_SENSOR_CHARACTERISTIC, TEMPERATURE, value)
+
+#define SENSOR_ID(_name, ...) SENSOR_##_name,
+enum { SENSORS(SENSOR_ID) SENSOR_COUNT };
+
+struct sensor {
+	struct value_slot value;
+
+	/* catch-up, under catch_up_lock */
+	struct bt_conn *conn;           // NULL when there is none
+	u32_t next;                     // seq of the next sample to send
+	u32_t until;                    // seq of the last sample to send at most
+	u16_t generation;               // moves on with every catch-up that stops
+	u8_t in_flight;                 // runs of this generation not sent yet
+};
+
+#define SENSOR_NAME(_name, _label, ...) [SENSOR_##_name] = _label,
+
+static const char *const sensor_names[] = { SENSORS(SENSOR_NAME) };
+
+static struct history_entry history_entries[SENSOR_COUNT][CONFIG_APP_HISTORY_SIZE];
+
+#define SENSOR_HISTORY(_name, ...)						\
+	[SENSOR_##_name] = {							\
+		.entries = history_entries[SENSOR_##_name],			\
+		.size = CONFIG_APP_HISTORY_SIZE,				\
+	},
+
+static struct history histories[] = { SENSORS(SENSOR_HISTORY) };
+static struct sensor sensors[SENSOR_COUNT];
+
+static ssize_t read_sample(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			   void *buf, u16_t len, u16_t offset);
+static ssize_t write_since(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			   const void *buf, u16_t len, u16_t offset, u8_t flags);
+static void sample_ccc_changed(const struct bt_gatt_attr *attr, u16_t value);
+
+/* Every sensor has SENSOR_ATTRS attributes in the table, in this order, so
+ * the attributes of sensor id are found by indexing, and the sensor of an
+ * attribute by its offset in the table. The handlers need no user data.
+ */
+#define SENSOR_ATTRS      4
+#define SENSOR_VALUE_ATTR 2
+#define SENSOR_CCC_ATTR   3
+
+#define SENSOR_SERVICE(_name, _label, _service, _chrc, ...)		\
+	BT_GATT_PRIMARY_SERVICE(_service),					\
+	/* it can be read from and subscribed to, and written for catch-up */	\
+	BT_GATT_CHARACTERISTIC(_chrc,						\
+			       BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY |	\
+			       BT_GATT_CHRC_WRITE,				\
+			       BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,		\
+			       read_sample, write_since, NULL),			\
+	BT_GATT_CCC(sample_ccc_changed,						\
+		    BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+
+BT_GATT_SERVICE_DEFINE(sensor_svc, SENSORS(SENSOR_SERVICE));
+
+static inline int sensor_id(const struct bt_gatt_attr *attr)
+{
+	return (u32_t)(attr - sensor_svc.attrs) / SENSOR_ATTRS;
 }
 
-static ssize_t read_temperature(struct bt_conn* conn, const struct bt_gatt_attr *attr, void *buf, u16_t len, u16_t offset) {
-	return bt_gatt_attr_read(conn, attr, buf, len, offset, &temperature, sizeof(temperature));
+static inline const struct bt_gatt_attr *sensor_attr(int id)
+{
+	return &sensor_svc.attrs[id * SENSOR_ATTRS + SENSOR_VALUE_ATTR];
 }
 
-BT_GATT_SERVICE_DEFINE(temp,
-	BT_GATT_PRIMARY_SERVICE(BT_UUID_TEMPERATURE_SENSOR_SERVICE),
-	BT_GATT_CHARACTERISTIC(BT_UUID_TEMPERATURE_SENSOR_CHARACTERISTIC,
-			       BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY, // it can be read from and subscribed to
-			       BT_GATT_PERM_READ, read_temperature, NULL,
-			       &temperature),
-	BT_GATT_CCC(tempoct_ccc_cfg_changed,
-		    BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
-);
+/* Samples are sent in the wire format generated from common/wire.schema.
+ * The encoder writes at most WIRE_SAMPLE_MAX_SIZE bytes, so it can not fail.
+ */
+#define SENSOR_ENCODE(_name, _label, _service, _chrc, _tag, _field)	\
+	case SENSOR_##_name:						\
+		s.tag = WIRE_SAMPLE_##_tag;				\
+		s._name._field = value;					\
+		s._name.seq = seq;					\
+		break;
+
+static u16_t encode_sample(int id, int value, u32_t seq, u8_t *buf)
+{
+	struct wire_sample s;
+
+	switch (id) {
+	SENSORS(SENSOR_ENCODE)
+	}
+	return wire_encode_sample(&s, buf, WIRE_SAMPLE_MAX_SIZE);
+}
 
-int bt_gatt_get_temperature(void) { return temperature; }
+static u16_t encode_current(int id, u8_t *buf)
+{
+	u32_t seq;
+	int current = value_store_get_int(&sensors[id].value, &seq);
 
-int bt_gatt_set_temperature(int new_temperature) {
-    temperature = new_temperature;
-    int rc = bt_gatt_notify(NULL, &temp.attrs[1], &new_temperature, sizeof(new_temperature));
-    return rc == -ENOTCONN ? 0 : rc;
+	return encode_sample(id, current, seq, buf);
 }
 
-static void temperature_notify(void)
+static ssize_t read_sample(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			   void *buf, u16_t len, u16_t offset)
 {
-	int current = bt_gatt_get_temperature();
-	current -= 1;
+	u8_t value[WIRE_SAMPLE_MAX_SIZE];
+	u16_t value_len = encode_current(sensor_id(attr), value);
 
-	if (!current) {
-		current = 35;
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, value, value_len);
+}
+
+/********** Flush **********/
+/* Setting a value only marks its sensor dirty. A single work item then
+ * notifies the newest value of every dirty sensor in one go, so however
+ * many sensors changed, their notifications are queued to the stack
+ * together and go out in the same connection event, and the broadcast is
+ * updated once. A sensor set again before the flush is notified once, the
+ * client sees the gap in the sequence numbers and the samples in between
+ * are still in the history.
+ */
+static ATOMIC_DEFINE(sensors_dirty, SENSOR_COUNT);
+
+static void flush_sensors(struct k_work *work)
+{
+	for (int id = 0; id < SENSOR_COUNT; id++) {
+		if (!atomic_test_and_clear_bit(sensors_dirty, id)) {
+			continue;
+		}
+
+		u8_t value[WIRE_SAMPLE_MAX_SIZE];
+		u16_t value_len = encode_current(id, value);
+		int rc = bt_gatt_notify(NULL, sensor_attr(id), value, value_len);
+
+		count_notify(sensor_attr(id), rc, value_len);
 	}
 
-	bt_gatt_set_temperature(current);
+	broadcast_update();
+}
+
+static K_WORK_DEFINE(flush_work, flush_sensors);
+
+/* Stores a new value, keeps it in the history and schedules its notification */
+static int sensor_set(int id, int new_value)
+{
+	struct sensor *s = &sensors[id];
+	int err = value_store_set_int(&s->value, new_value);
+
+	if (err) {
+		return err;
+	}
+
+	history_record(&histories[id], value_store_version(&s->value), new_value);
+	atomic_set_bit(sensors_dirty, id);
+	k_work_submit(&flush_work);
+	return 0;
+}
+
+#define SENSOR_API(_name, ...)							\
+	int bt_gatt_get_##_name(void)						\
+	{									\
+		return value_store_get_int(&sensors[SENSOR_##_name].value, NULL); \
+	}									\
+	int bt_gatt_set_##_name(int new_value)					\
+	{									\
+		return sensor_set(SENSOR_##_name, new_value);			\
+	}
+
+SENSORS(SENSOR_API)
+
+/********** Catch-up **********/
+/* After a reconnect the client writes History.Since with the seq of the last
+ * sample it has to the sample characteristic. The samples after it that are
+ * still in the history ring are notified on the same characteristic as
+ * History.Runs, each packing as many Samples as the ATT MTU allows. Up to
+ * CATCH_UP_WINDOW runs are handed to the stack at a time and the next ones
+ * follow as it sends them, so the backlog goes out as fast as the link takes
+ * it. Samples that were overwritten before they were sent are skipped, the
+ * client sees the gap in the sequence numbers. The catch-up also sends the
+ * samples written while it runs, up to another ring's worth, so that one on
+ * a link that can not keep up comes to an end. One work item runs the
+ * catch-ups of all sensors.
+ *
+ * The stack frees the runs it still holds when the link drops without
+ * calling run_sent. So in_flight counts the runs of the current catch-up
+ * only, and every catch-up that stops moves the generation on. A run
+ * carries the generation and the sensor in its user data, and a run_sent of
+ * an earlier generation is ignored.
+ */
+#define CATCH_UP_WINDOW 2
+#define RUN_MAX         (CONFIG_BT_L2CAP_TX_MTU - 3)
+#define RUN_SENSOR_BITS 8
+
+BUILD_ASSERT(SENSOR_COUNT <= BIT(RUN_SENSOR_BITS));
+
+K_MUTEX_DEFINE(catch_up_lock);
+
+static void catch_up_work(struct k_work *work);
+static K_WORK_DEFINE(catch_up, catch_up_work);
+
+/* Must hold catch_up_lock */
+static void catch_up_stop(struct sensor *s)
+{
+	if (s->conn) {
+		bt_conn_unref(s->conn);
+		s->conn = NULL;
+	}
+	s->generation++;
+	s->in_flight = 0;
+}
+
+static void run_sent(struct bt_conn *conn, void *user_data)
+{
+	u32_t tag = POINTER_TO_UINT(user_data);
+	struct sensor *s = &sensors[tag & BIT_MASK(RUN_SENSOR_BITS)];
+
+	k_mutex_lock(&catch_up_lock, K_FOREVER);
+	// a run of an earlier catch-up does not count
+	if ((u16_t)(tag >> RUN_SENSOR_BITS) == s->generation) {
+		s->in_flight--;
+	}
+	k_mutex_unlock(&catch_up_lock);
+
+	k_work_submit(&catch_up);
+}
+
+/* Must hold catch_up_lock. Packs the samples of s from its next on into a
+ * run in pdu and returns its length.
+ */
+static int pack_run(struct sensor *s, int id, u32_t newest, u8_t *pdu,
+		    u16_t size)
+{
+	static u8_t samples[RUN_MAX];
+	struct wire_history run = { .tag = WIRE_HISTORY_RUN };
+	u32_t now = k_uptime_get_32();
+
+	run.run.newest = newest;
+	run.run.samples.data = samples;
+	s->next = MAX(s->next, history_oldest(&histories[id], newest));
+
+	while (s->next <= newest &&
+	       run.run.samples.len + WIRE_SAMPLE_MAX_SIZE <= sizeof(samples)) {
+		u32_t time;
+		s32_t value;
+
+		if (history_get(&histories[id], s->next, &time, &value)) {
+			s->next++;
+			continue;
+		}
+
+		u16_t len = run.run.samples.len;
+
+		if (!len) {
+			run.run.age = now - time;
+		}
+		run.run.samples.len += encode_sample(id, value, s->next, &samples[len]);
+		if (wire_encode_history(&run, pdu, size) < 0) {
+			// take the sample back, if it does not fit on its own the
+			// client sees a gap
+			run.run.samples.len = len;
+			if (len) {
+				break;
+			}
+		}
+		s->next++;
+	}
+
+	// a failed attempt may have left pdu half written
+	return wire_encode_history(&run, pdu, size);
+}
+
+/* Must hold catch_up_lock. Hands runs of sensor id to the stack while its
+ * window has room.
+ */
+static void catch_up_sensor(int id)
+{
+	struct sensor *s = &sensors[id];
+	const struct bt_gatt_attr *attr = sensor_attr(id);
+	static u8_t pdu[RUN_MAX];
+
+	// the Since usually comes before the CCC write, which submits us again
+	while (s->conn &&
+	       s->in_flight < CATCH_UP_WINDOW &&
+	       bt_gatt_is_subscribed(s->conn, attr, BT_GATT_CCC_NOTIFY)) {
+		u32_t newest = MIN(value_store_version(&s->value), s->until);
+		u16_t size = MIN(bt_gatt_get_mtu(s->conn) - 3, sizeof(pdu));
+		u32_t tag = (u32_t)s->generation << RUN_SENSOR_BITS | id;
+		struct bt_gatt_notify_params params = {
+			.attr = attr,
+			.data = pdu,
+			.len = pack_run(s, id, newest, pdu, size),
+			.func = run_sent,
+			.user_data = UINT_TO_POINTER(tag),
+		};
+
+		s->in_flight++;
+		int err = bt_gatt_notify_cb(s->conn, &params);
+		if (err) {
+			s->in_flight--;
+			link_stats_error(s->conn);
+			printk("%s catch-up failed (err %d)\n", sensor_names[id], err);
+			catch_up_stop(s);
+			break;
+		}
+		link_stats_tx(s->conn, params.len);
+
+		if (s->next > newest) {
+			printk("%s catch-up complete at %u\n", sensor_names[id], newest);
+			catch_up_stop(s);
+		}
+	}
 }
 
-/********** Octavius sensor **********/
-int octavius;
+static void catch_up_work(struct k_work *work)
+{
+	k_mutex_lock(&catch_up_lock, K_FOREVER);
+	for (int id = 0; id < SENSOR_COUNT; id++) {
+		catch_up_sensor(id);
+	}
+	k_mutex_unlock(&catch_up_lock);
+}
 
-static void tempoct2_ccc_cfg_changed(const struct bt_gatt_attr *attr,
-				       u16_t value)
+static ssize_t write_since(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			   const void *buf, u16_t len, u16_t offset, u8_t flags)
 {
-	ARG_UNUSED(attr);
+	int id = sensor_id(attr);
+	struct sensor *s = &sensors[id];
+	struct wire_history h;
 
+	if (offset) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+	if (wire_decode_history(buf, len, &h) < 0 || h.tag != WIRE_HISTORY_SINCE) {
+		return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+	}
+
+	k_mutex_lock(&catch_up_lock, K_FOREVER);
+	catch_up_stop(s);
+	s->conn = bt_conn_ref(conn);
+	s->next = h.since.seq + 1;
+	s->until = value_store_version(&s->value) + CONFIG_APP_HISTORY_SIZE;
+	k_mutex_unlock(&catch_up_lock);
+
+	printk("%s catch-up since %u\n", sensor_names[id], h.since.seq);
+	k_work_submit(&catch_up);
+	return len;
+}
+
+static void sample_ccc_changed(const struct bt_gatt_attr *attr, u16_t value)
+{
+	int id = sensor_id(attr);
 	bool notif_enabled = (value == BT_GATT_CCC_NOTIFY);
 
-	printk("Octavius Notifications %s\n", notif_enabled ? "enabled" : "disabled");
+	printk("%s Notifications %s\n", sensor_names[id],
+	       notif_enabled ? "enabled" : "disabled");
+	// the catch-up checks the subscription itself
+	k_work_submit(&catch_up);
 }
 
-static ssize_t read_octavius(struct bt_conn* conn, const struct bt_gatt_attr *attr, void *buf, u16_t len, u16_t offset) {
-	return bt_gatt_attr_read(conn, attr, buf, len, offset, &octavius, sizeof(octavius));
+static void catch_up_disconnected(struct bt_conn *conn)
+{
+	k_mutex_lock(&catch_up_lock, K_FOREVER);
+	for (int id = 0; id < SENSOR_COUNT; id++) {
+		if (sensors[id].conn == conn) {
+			catch_up_stop(&sensors[id]);
+		}
+	}
+	k_mutex_unlock(&catch_up_lock);
 }
 
-BT_GATT_SERVICE_DEFINE(oct,
-	BT_GATT_PRIMARY_SERVICE(BT_UUID_OCTAVIUS_SERVICE),
-	BT_GATT_CHARACTERISTIC(BT_UUID_OCTAVIUS_CHARACTERISTIC,
-			       BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY, // it can be read from and subscribed to
-			       BT_GATT_PERM_READ, read_octavius, NULL,
-			       &octavius),
-	BT_GATT_CCC(tempoct2_ccc_cfg_changed,
-		    BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
-);
+/********** Example values **********/
+static void temperature_notify(void)
+{
+	int current = bt_gatt_get_temperature();
+	current -= 1;
 
-int bt_gatt_get_octavius(void) { return octavius; }
+	if (!current) {
+		current = 35;
+	}
 
-int bt_gatt_set_octavius(int new_octavius) {
-    octavius = new_octavius;
-    int rc = bt_gatt_notify(NULL, &oct.attrs[1], &new_octavius, sizeof(new_octavius));
-    return rc == -ENOTCONN ? 0 : rc;
+	bt_gatt_set_temperature(current);
 }
 
 static void octavius_notify(void)
@@ -124,7 +462,96 @@ static void octavius_notify(void)
 }
 /*************************************/
 
-struct bt_conn *default_conn;
+/********** Broadcast **********/
+/* With CONFIG_APP_BROADCAST the values are also published as service data
+ * for the device UUID in a non-connectable extended advertising set, so that
+ * listeners do not need a connection each. The version is the sum of the
+ * versions of the values, so it changes with every write and lets observers
+ * skip the repeated advertising events.
+ */
+static struct bt_le_ext_adv *broadcast_adv;
+
+/* Every sensor has a field of its name in wire_broadcast */
+#define BROADCAST_SAMPLE(_name, ...)						\
+	b.samples._name = value_store_get_int(&sensors[SENSOR_##_name].value,	\
+					      &seq);				\
+	b.samples.version += seq;
+
+static void broadcast_update(void)
+{
+	struct wire_broadcast b = { .tag = WIRE_BROADCAST_SAMPLES };
+	u8_t data[2 + WIRE_BROADCAST_MAX_SIZE];
+	u32_t seq;
+	int err;
+
+	if (!IS_ENABLED(CONFIG_APP_BROADCAST) || !broadcast_adv) {
+		return;
+	}
+
+	SENSORS(BROADCAST_SAMPLE)
+
+	sys_put_le16(0xffcc, data);
+	u16_t len = 2 + wire_encode_broadcast(&b, &data[2], WIRE_BROADCAST_MAX_SIZE);
+	struct bt_data bd[] = {
+		BT_DATA(BT_DATA_SVC_DATA16, data, len),
+	};
+
+	err = bt_le_ext_adv_set_data(broadcast_adv, bd, ARRAY_SIZE(bd), NULL, 0);
+	if (err) {
+		printk("Failed to set broadcast data (err %d)\n", err);
+	}
+
+#if defined(CONFIG_BT_PER_ADV)
+	err = bt_le_per_adv_set_data(broadcast_adv, bd, ARRAY_SIZE(bd));
+	if (err) {
+		printk("Failed to set periodic broadcast data (err %d)\n", err);
+	}
+#endif
+}
+
+static void broadcast_start(void)
+{
+	int err;
+
+	err = bt_le_ext_adv_create(BT_LE_ADV_PARAM(BT_LE_ADV_OPT_EXT_ADV,
+						   BT_GAP_ADV_FAST_INT_MIN_2,
+						   BT_GAP_ADV_FAST_INT_MAX_2,
+						   NULL),
+				   NULL, &broadcast_adv);
+	if (err) {
+		printk("Failed to create broadcast set (err %d)\n", err);
+		broadcast_adv = NULL;
+		return;
+	}
+
+#if defined(CONFIG_BT_PER_ADV)
+	err = bt_le_per_adv_set_param(broadcast_adv,
+				      BT_LE_PER_ADV_PARAM(BT_GAP_PER_ADV_FAST_INT_MIN_2,
+							  BT_GAP_PER_ADV_FAST_INT_MAX_2,
+							  BT_LE_PER_ADV_OPT_NONE));
+	if (err) {
+		printk("Failed to set periodic advertising parameters (err %d)\n", err);
+	}
+#endif
+
+	broadcast_update();
+
+	err = bt_le_ext_adv_start(broadcast_adv, BT_LE_EXT_ADV_START_DEFAULT);
+	if (err) {
+		printk("Failed to start broadcasting (err %d)\n", err);
+		return;
+	}
+
+#if defined(CONFIG_BT_PER_ADV)
+	err = bt_le_per_adv_start(broadcast_adv);
+	if (err) {
+		printk("Failed to start periodic advertising (err %d)\n", err);
+	}
+#endif
+
+	printk("Broadcasting successfully started\n");
+}
+/*******************************/
 
 static const struct bt_data ad[] = {
 	BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
@@ -146,6 +573,8 @@ static void disconnected(struct bt_conn *conn, u8_t reason)
 {
 	printk("Disconnected (reason 0x%02x)\n", reason);
 
+	catch_up_disconnected(conn);
+
 	if (default_conn) {
 		bt_conn_unref(default_conn);
 		default_conn = NULL;
@@ -170,6 +599,10 @@ static void bt_ready(void)
 	}
 
 	printk("Advertising successfully started\n");
+
+	if (IS_ENABLED(CONFIG_APP_BROADCAST)) {
+		broadcast_start();
+	}
 }
 
 static void auth_cancel(struct bt_conn *conn)
@@ -181,26 +614,55 @@ static void auth_cancel(struct bt_conn *conn)
 	printk("Pairing cancelled: %s\n", addr);
 }
 
+static void pairing_complete(struct bt_conn *conn, bool bonded)
+{
+	char addr[BT_ADDR_LE_STR_LEN];
+
+	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
+
+	printk("Pairing completed: %s, bonded: %d\n", addr, bonded);
+}
+
+static void pairing_failed(struct bt_conn *conn, enum bt_security_err reason)
+{
+	char addr[BT_ADDR_LE_STR_LEN];
+
+	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
+
+	printk("Pairing failed: %s (reason %d)\n", addr, reason);
+}
+
 static struct bt_conn_auth_cb auth_cb_display = {
 	.cancel = auth_cancel,
+	.pairing_complete = pairing_complete,
+	.pairing_failed = pairing_failed,
 };
 
 void main(void)
 {
-	temperature = 35;
-	octavius = 1;
 	int err;
 
+	bt_gatt_set_temperature(35);
+	bt_gatt_set_octavius(1);
+
 	err = bt_enable(NULL);
 	if (err) {
 		printk("Bluetooth init failed (err %d)\n", err);
 		return;
 	}
 
+	/* Restore bonds before we become connectable, so that a bonded
+	 * client can encrypt the link straight away
+	 */
+	if (IS_ENABLED(CONFIG_SETTINGS)) {
+		settings_load();
+	}
+
 	bt_ready();
 
 	bt_conn_cb_register(&conn_callbacks);
 	bt_conn_auth_cb_register(&auth_cb_display);
+	link_stats_init();
 
 	/* Implement notification. At the moment there is no suitable way
 	 * of starting delayed work so we do it here